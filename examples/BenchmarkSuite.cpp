@@ -0,0 +1,317 @@
+#include <Cajita.hpp>
+#include <PFHub.hpp>
+#include <Cabana_BenchmarkUtils.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace CabanaPF;
+
+/*Benchmark suite for tracking performance over time.  Runs PFHub1aPeriodic at each requested grid size and writes
+one record per grid size (CSV and/or JSON) with system info, setup and step times, per-phase times, and throughput.
+Times are statistics over all ranks and repeats.  Given a baseline CSV from an earlier run, it compares median step
+times and exits with 1 if any got slower by more than the tolerance.*/
+namespace {
+
+using Cabana::Benchmark::Statistics;
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+    std::vector<int> grid_points;
+    int timesteps = 500;
+    int repeats = 3;
+    bool fused = false;
+    bool graphs = false;    //replay captured timesteps (see CabanaPFRunner::set_graph_capture)
+    bool pipelined = false;     //transform df_dc after c, computing it meanwhile (see BasicPFHub1aBase::set_pipelined)
+    bool single = false;    //store and transform in float (see BasicPFHub1aBase)
+    bool plan_cache = false;    //reuse the first repeat's grid and plans (see PlanCache), so setup leaves them out
+    KernelTuning<2> tuning;     //--tile X Y: MDRange tile sizes; --team: TeamPolicy kernels (see KernelTuning)
+    Decomposition<2> decomposition;     //--slabs: one rank along y; --autotune: time the heFFTe plan options
+    std::string csv_file;
+    std::string json_file;
+    std::string baseline_file;
+    double tolerance = .1;
+};
+
+struct Record {
+    int grid_points;
+    Statistics setup;   //seconds
+    Statistics step;    //seconds per timestep
+    std::vector<std::pair<std::string, Statistics>> phases; //seconds per timestep
+    double cell_updates_per_second;
+    double effective_GBps;
+    double peak_scratch_MB;     //of the scratch arena (temporaries and FFT buffers), on the rank using the most
+};
+
+struct System {
+    std::string host;
+    std::string backend;
+    int concurrency;
+    int kokkos_version;
+    int num_rank;
+};
+
+double seconds_since(const clock_type::time_point start) {
+    Kokkos::fence();
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+//returns false (after printing usage) if the arguments don't make sense
+bool parse(int argc, char* argv[], Options& options) {
+    try {
+        for (int i=1; i<argc; i++) {
+            const std::string arg = argv[i];
+            const bool has_value = i+1 < argc;
+            if (arg == "--timesteps" && has_value)
+                options.timesteps = std::stoi(argv[++i]);
+            else if (arg == "--repeats" && has_value)
+                options.repeats = std::stoi(argv[++i]);
+            else if (arg == "--fused")
+                options.fused = true;
+            else if (arg == "--graphs")
+                options.graphs = true;
+            else if (arg == "--pipelined")
+                options.pipelined = true;
+            else if (arg == "--float")
+                options.single = true;
+            else if (arg == "--plan-cache")
+                options.plan_cache = true;
+            else if (arg == "--tile" && i+2 < argc) {
+                options.tuning.tile[0] = std::stoi(argv[++i]);
+                options.tuning.tile[1] = std::stoi(argv[++i]);
+            }
+            else if (arg == "--team")
+                options.tuning.team = true;
+            else if (arg == "--slabs") {
+                MPI_Comm_size(MPI_COMM_WORLD, &options.decomposition.ranks_per_dim[0]);
+                options.decomposition.ranks_per_dim[1] = 1;
+            }
+            else if (arg == "--autotune")
+                options.decomposition.fft.autotune = true;
+            else if (arg == "--csv" && has_value)
+                options.csv_file = argv[++i];
+            else if (arg == "--json" && has_value)
+                options.json_file = argv[++i];
+            else if (arg == "--baseline" && has_value)
+                options.baseline_file = argv[++i];
+            else if (arg == "--tolerance" && has_value)
+                options.tolerance = std::stod(argv[++i]);
+            else
+                options.grid_points.push_back(std::stoi(arg));
+        }
+    } catch (std::logic_error&) {
+        options.grid_points.clear();
+    }
+    if (options.grid_points.empty()) {
+        std::cout << "Usage: ./BenchmarkSuite [--timesteps T] [--repeats R] [--fused] [--graphs] [--pipelined] [--float] [--plan-cache] [--tile X Y] [--team] [--slabs] [--autotune] [--csv file] [--json file]"
+            << " [--baseline file.csv] [--tolerance fraction] grid_points [grid_points ...]" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <class Simulation>
+Record run(const int grid_points, const Options& options, MPI_Comm comm) {
+    Record record;
+    record.grid_points = grid_points;
+    std::vector<double> setup_times, step_times;
+    std::vector<std::string> phase_names;
+    std::map<std::string, std::vector<double>> phase_times;
+    double bytes_per_step = 0;
+    double peak_scratch = 0;
+    std::string plan;
+
+    for (int rep=0; rep<options.repeats; rep++) {
+        MPI_Barrier(comm);
+        auto start = clock_type::now();
+        //twice as many steps: the first half is timed as a whole, the second half per phase (which adds fences)
+        Simulation simulation(grid_points, 2*options.timesteps, comm, options.decomposition);
+        simulation.set_fused(options.fused);
+        simulation.set_graph_capture(options.graphs);
+        simulation.set_kernel_tuning(options.tuning);
+        simulation.set_pipelined(options.pipelined);
+        simulation.timestep(0);
+        setup_times.push_back(seconds_since(start));
+
+        MPI_Barrier(comm);
+        start = clock_type::now();
+        simulation.timestep(options.timesteps);
+        step_times.push_back(seconds_since(start) / options.timesteps);
+
+        simulation.phase_timers().enable(true);
+        simulation.timestep(options.timesteps);
+        phase_names = simulation.phase_timers().phases();
+        for (const auto& name : phase_names)
+            phase_times[name].push_back(simulation.phase_timers().total(name) / options.timesteps);
+        bytes_per_step = simulation.bytes_per_step();
+        plan = simulation.fft_plan();
+        peak_scratch = std::max(peak_scratch, static_cast<double>(simulation.scratch_usage().peak_reserved));
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &peak_scratch, 1, MPI_DOUBLE, MPI_MAX, comm);
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (0 == rank)
+        std::cout << "FFT plan: " << plan << std::endl;
+
+    record.setup = Cabana::Benchmark::gatherStatistics(setup_times, comm);
+    record.step = Cabana::Benchmark::gatherStatistics(step_times, comm);
+    for (const auto& name : phase_names)
+        record.phases.push_back({name, Cabana::Benchmark::gatherStatistics(phase_times[name], comm)});
+    record.cell_updates_per_second = static_cast<double>(grid_points) * grid_points / record.step.median;
+    record.effective_GBps = bytes_per_step / record.step.median / 1e9;
+    record.peak_scratch_MB = peak_scratch / 1e6;
+    return record;
+}
+
+void write_csv(std::ostream& stream, const System& system, const Options& options, const std::vector<Record>& records) {
+    stream << "host,backend,num_rank,grid_points,timesteps,fused,precision,setup_median,step_median,step_p10,step_p90,"
+        << "step_min,step_max,cell_updates_per_s,effective_GBps,peak_scratch_MB";
+    for (const auto& phase : records.front().phases)
+        stream << "," << phase.first << "_median," << phase.first << "_p90";
+    stream << "\n";
+    for (const auto& record : records) {
+        stream << system.host << "," << system.backend << "," << system.num_rank << "," << record.grid_points << ","
+            << options.timesteps << "," << options.fused << "," << (options.single ? "float" : "double") << "," << record.setup.median << "," << record.step.median
+            << "," << record.step.p10 << "," << record.step.p90 << "," << record.step.min << "," << record.step.max
+            << "," << record.cell_updates_per_second << "," << record.effective_GBps << "," << record.peak_scratch_MB;
+        for (const auto& phase : record.phases)
+            stream << "," << phase.second.median << "," << phase.second.p90;
+        stream << "\n";
+    }
+}
+
+void write_statistics(std::ostream& stream, const Statistics& stats) {
+    stream << "{\"min\": " << stats.min << ", \"max\": " << stats.max << ", \"mean\": " << stats.mean
+        << ", \"median\": " << stats.median << ", \"p10\": " << stats.p10 << ", \"p90\": " << stats.p90
+        << ", \"samples\": " << stats.count << "}";
+}
+
+void write_json(std::ostream& stream, const System& system, const Options& options, const std::vector<Record>& records) {
+    stream << "{\n  \"system\": {\"host\": \"" << system.host << "\", \"backend\": \"" << system.backend
+        << "\", \"concurrency\": " << system.concurrency << ", \"kokkos_version\": " << system.kokkos_version
+        << ", \"num_rank\": " << system.num_rank << "},\n";
+    stream << "  \"problem\": {\"name\": \"PFHub1aPeriodic\", \"timesteps\": " << options.timesteps
+        << ", \"repeats\": " << options.repeats << ", \"fused\": " << (options.fused ? "true" : "false")
+        << ", \"graphs\": " << (options.graphs ? "true" : "false") << ", \"pipelined\": " << (options.pipelined ? "true" : "false") << ", \"plan_cache\": " << (options.plan_cache ? "true" : "false")
+        << ", \"tile\": [" << options.tuning.tile[0] << ", " << options.tuning.tile[1] << "], \"team\": " << (options.tuning.team ? "true" : "false")
+        << ", \"precision\": \"" << (options.single ? "float" : "double")
+        << "\"},\n";
+    stream << "  \"results\": [\n";
+    for (std::size_t r=0; r<records.size(); r++) {
+        const auto& record = records[r];
+        stream << "    {\"grid_points\": " << record.grid_points << ", \"setup_s\": ";
+        write_statistics(stream, record.setup);
+        stream << ", \"step_s\": ";
+        write_statistics(stream, record.step);
+        stream << ", \"cell_updates_per_s\": " << record.cell_updates_per_second
+            << ", \"effective_GBps\": " << record.effective_GBps << ", \"peak_scratch_MB\": " << record.peak_scratch_MB
+            << ", \"phases_s\": {";
+        for (std::size_t p=0; p<record.phases.size(); p++) {
+            stream << (p ? ", " : "") << "\"" << record.phases[p].first << "\": ";
+            write_statistics(stream, record.phases[p].second);
+        }
+        stream << "}}" << (r+1 < records.size() ? "," : "") << "\n";
+    }
+    stream << "  ]\n}\n";
+}
+
+std::vector<std::string> split(const std::string& line) {
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ','))
+        fields.push_back(field);
+    return fields;
+}
+
+//Compare median step times with a CSV written by an earlier run; returns how many regressed
+int compare(const std::string& baseline_file, const System& system, const Options& options, const std::vector<Record>& records) {
+    std::ifstream baseline(baseline_file);
+    std::string line;
+    if (!std::getline(baseline, line)) {
+        std::cout << "Could not read baseline " << baseline_file << std::endl;
+        return 0;
+    }
+    const auto header = split(line);
+    const auto column = [&](const std::string& name) {
+        return std::find(header.begin(), header.end(), name) - header.begin();
+    };
+    const std::size_t grid_column = column("grid_points"), rank_column = column("num_rank"), step_column = column("step_median");
+    int regressions = 0;
+    while (std::getline(baseline, line)) {
+        const auto fields = split(line);
+        if (fields.size() <= std::max({grid_column, rank_column, step_column}) || std::stoi(fields[rank_column]) != system.num_rank)
+            continue;
+        //baselines from before the precision column are all double
+        const std::size_t precision_column = column("precision");
+        const std::string precision = precision_column < fields.size() ? fields[precision_column] : "double";
+        if (precision != (options.single ? "float" : "double"))
+            continue;
+        for (const auto& record : records) {
+            if (record.grid_points != std::stoi(fields[grid_column]))
+                continue;
+            const double before = std::stod(fields[step_column]);
+            const double change = record.step.median/before - 1;
+            const bool regressed = change > options.tolerance;
+            regressions += regressed;
+            std::cout << (regressed ? "REGRESSION " : "ok ") << record.grid_points << " grid points: " << before
+                << " -> " << record.step.median << " s/step (" << 100*change << "%)" << std::endl;
+        }
+    }
+    return regressions;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    MPI_Init( &argc, &argv );
+    int regressions = 0;
+    {
+        bind_device();  //before Kokkos picks a GPU
+        Kokkos::ScopeGuard scope_guard( argc, argv );
+        Options options;
+        if (!parse(argc, argv, options))
+            return 1;
+        PlanCache::enable(options.plan_cache);
+
+        System system;
+        char host[MPI_MAX_PROCESSOR_NAME];
+        int length;
+        MPI_Get_processor_name(host, &length);
+        system.host = std::string(host, length);
+        system.backend = Kokkos::DefaultExecutionSpace::name();
+        system.concurrency = Kokkos::DefaultExecutionSpace().concurrency();
+        system.kokkos_version = KOKKOS_VERSION;
+        MPI_Comm_size(MPI_COMM_WORLD, &system.num_rank);
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+        std::vector<Record> records;
+        for (const int grid_points : options.grid_points) {
+            if (0 == rank)
+                std::cout << "Running " << grid_points << " grid points" << std::endl;
+            records.push_back(options.single ? run<BasicPFHub1aPeriodic<float>>(grid_points, options, MPI_COMM_WORLD)
+                : run<PFHub1aPeriodic>(grid_points, options, MPI_COMM_WORLD));
+        }
+
+        if (0 == rank) {
+            write_csv(std::cout, system, options, records);
+            if (!options.csv_file.empty()) {
+                std::ofstream csv(options.csv_file);
+                write_csv(csv, system, options, records);
+            }
+            if (!options.json_file.empty()) {
+                std::ofstream json(options.json_file);
+                write_json(json, system, options, records);
+            }
+            if (!options.baseline_file.empty())
+                regressions = compare(options.baseline_file, system, options, records);
+        }
+        MPI_Bcast(&regressions, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    MPI_Finalize();
+    return regressions > 0;
+}
@@ -0,0 +1,71 @@
+#include <CahnHilliard.hpp>
+#include <FiniteDifference.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace CabanaPF;
+
+//Run PeriodicCahnHilliard on the chosen Solver, reporting the timestep rate
+template <std::size_t NumSpaceDim, template <std::size_t, class> class Solver>
+void run(const int grid_points, const int timesteps, const CahnHilliardParameters& parameters, const bool should_write) {
+    PeriodicCahnHilliard<NumSpaceDim, double, Solver> simulation(grid_points, timesteps, parameters);
+    simulation.timestep(0);     //initialize before timing
+    Kokkos::fence();
+    const auto start = std::chrono::steady_clock::now();
+    simulation.timestep(timesteps);
+    Kokkos::fence();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (0 == rank)
+        std::cout << simulation.run_name() << ": " << timesteps/elapsed << " timesteps/s" << std::endl;
+    if (should_write)
+        simulation.output();
+}
+
+int main(int argc, char* argv[]) {
+    MPI_Init( &argc, &argv );
+    {
+        bind_device();  //before Kokkos picks a GPU
+        Kokkos::ScopeGuard scope_guard( argc, argv );
+        bool stencil = false, three_d = false, should_write = false;
+        CahnHilliardParameters parameters;
+        std::vector<std::string> positional;
+        try {
+            for (int i=1; i<argc; i++) {
+                const std::string arg = argv[i];
+                if (arg == "--stencil")
+                    stencil = true;
+                else if (arg == "--3d")
+                    three_d = true;
+                else if (arg == "--write")
+                    should_write = true;
+                else if (arg == "--end-time" && i+1 < argc)
+                    parameters.end_time = std::stod(argv[++i]);
+                else
+                    positional.push_back(arg);
+            }
+            if (positional.size() != 2)
+                throw std::invalid_argument("need grid_points and timesteps");
+            const int grid_points = std::stoi(positional[0]);
+            const int timesteps = std::stoi(positional[1]);
+            //the stencil backend is explicit, so needs far more timesteps to reach the same end time (see max_stable_dt)
+            if (stencil && three_d)
+                run<3, FiniteDifferenceCahnHilliard>(grid_points, timesteps, parameters, should_write);
+            else if (stencil)
+                run<2, FiniteDifferenceCahnHilliard>(grid_points, timesteps, parameters, should_write);
+            else if (three_d)
+                run<3, CahnHilliard>(grid_points, timesteps, parameters, should_write);
+            else
+                run<2, CahnHilliard>(grid_points, timesteps, parameters, should_write);
+        } catch (std::logic_error& e) {
+            std::cout << e.what() << std::endl;
+            std::cout << "Usage: ./CahnHilliard [--stencil] [--3d] [--end-time t] [--write] grid_points timesteps" << std::endl;
+        }
+    }
+    MPI_Finalize();
+    return 0;
+}
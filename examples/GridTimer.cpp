@@ -7,6 +7,7 @@ using namespace CabanaPF;
 int main(int argc, char* argv[]) {
     MPI_Init( &argc, &argv );
     {
+        bind_device();  //before Kokkos picks a GPU
         Kokkos::ScopeGuard scope_guard( argc, argv );
 
         //read in grid points to run off the command line:
@@ -19,19 +20,30 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
-        //run these and measure how long they take:
-        Cabana::Benchmark::Timer timer("grid scaling", runs.size());
+        //run these and measure how long they take.  Setup (mesh, FFT plans, initial conditions) is timed separately;
+        //the repeats reuse the first one's grid and plans (see PlanCache), so theirs is mostly the initial conditions:
+        PlanCache::enable(true);
+        Cabana::Benchmark::Timer setup_timer("setup", runs.size(), true);
+        Cabana::Benchmark::Timer timer("grid scaling", runs.size(), true);
         for (std::size_t i=0; i<runs.size(); i++) {
             std::cout << "Running " << runs[i] << " grid points" << std::endl;
             for (int reps=0; reps<5; reps++) {
-                timer.start(i);
+                setup_timer.start(i);
                 PFHub1aPeriodic simul(runs[i], 500);
+                simul.timestep(0);  //initializes
+                setup_timer.stop(i);
+                //break down the last run by phase:
+                simul.phase_timers().enable(reps==4);
+                timer.start(i);
                 simul.timestep(500);
                 timer.stop(i);
+                if (reps==4)
+                    simul.phase_timers().report(std::cout, MPI_COMM_WORLD);
             }
         }
 
         //print results:
+        Cabana::Benchmark::outputResults(std::cout, "grid points", runs, setup_timer);
         Cabana::Benchmark::outputResults(std::cout, "grid points", runs, timer);
     }
     MPI_Finalize();
@@ -1,18 +1,40 @@
 #include <Cajita.hpp>
+#include <Ensemble.hpp>
 #include <PFHub.hpp>
 
+#include <memory>
+#include <vector>
+
 using namespace CabanaPF;
 int main(int argc, char* argv[]) {
     MPI_Init( &argc, &argv );
     {
+        bind_device();  //before Kokkos picks a GPU
         Kokkos::ScopeGuard scope_guard( argc, argv );
+        PlanCache::enable(true);    //the sweeps below construct several simulations on the same grids
         if (argc==1) {
-            //runs for the paper
-            for (int t=500; t<=1024000; t*=2) {
-                std::cout << "Running " << t << " timesteps" << std::endl;
-                PFHub1aPeriodic simulation(96, t);
-                simulation.timestep(t);
-                simulation.output();
+            //runs for the paper.  The timestep counts are split over the ranks, each running its share as one ensemble
+            std::vector<int> sweep;
+            for (int t=500; t<=1024000; t*=2)
+                sweep.push_back(t);
+            int size;
+            MPI_Comm_size(MPI_COMM_WORLD, &size);
+            const EnsembleGroups groups(MPI_COMM_WORLD, size);
+            std::vector<int> timesteps;
+            for (const int point : groups.assigned(std::vector<double>(sweep.begin(), sweep.end())))
+                timesteps.push_back(sweep[point]);
+            std::unique_ptr<PFHub1aEnsemble<PFHub1aPeriodic>> ensemble;
+            if (!timesteps.empty()) {
+                std::cout << "Running " << timesteps.size() << " timestep counts, up to " << timesteps.back() << std::endl;
+                ensemble = std::make_unique<PFHub1aEnsemble<PFHub1aPeriodic>>(96, timesteps, groups.comm());
+                ensemble->timestep(ensemble->timesteps);
+            }
+            //one group at a time, since saving goes through a temporary file with a fixed name
+            for (int g=0; g<groups.count(); g++) {
+                if (ensemble && g == groups.index())
+                    for (int m=0; m<ensemble->members(); m++)
+                        ensemble->output(m);
+                MPI_Barrier(MPI_COMM_WORLD);
             }
             for (int g=96; g<=6144; g*=2) {
                 std::cout << "Running " << g << " grid points" << std::endl;
@@ -0,0 +1,51 @@
+#include <PFHub2.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace CabanaPF;
+
+//Run PFHub2Benchmark with NumOrderParameters order parameters, reporting the timestep rate
+template <std::size_t NumOrderParameters>
+void run(const int grid_points, const int timesteps, const bool should_write) {
+    PFHub2Benchmark<NumOrderParameters> simulation(grid_points, timesteps);
+    simulation.timestep(0);     //initialize before timing
+    Kokkos::fence();
+    const auto start = std::chrono::steady_clock::now();
+    simulation.timestep(timesteps);
+    Kokkos::fence();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (0 == rank)
+        std::cout << simulation.run_name() << ": " << timesteps/elapsed << " timesteps/s" << std::endl;
+    if (should_write)
+        simulation.output();
+}
+
+int main(int argc, char* argv[]) {
+    MPI_Init( &argc, &argv );
+    {
+        bind_device();  //before Kokkos picks a GPU
+        Kokkos::ScopeGuard scope_guard( argc, argv );
+        try {
+            if (argc < 3)
+                throw std::invalid_argument("need grid_points and timesteps");
+            const int grid_points = std::stoi(argv[1]);
+            const int timesteps = std::stoi(argv[2]);
+            const bool many = argc > 3 && std::string(argv[3]) == "--many";
+            const bool should_write = !many && argc == 3;
+            //the benchmark's 4 order parameters, or 16 to see how the batched kernels and FFTs scale with the field count
+            if (many)
+                run<16>(grid_points, timesteps, should_write);
+            else
+                run<4>(grid_points, timesteps, should_write);
+        } catch (std::logic_error& e) {
+            std::cout << e.what() << std::endl;
+            std::cout << "Usage: ./PFHub2 grid_points timesteps [--many]" << std::endl;
+        }
+    }
+    MPI_Finalize();
+    return 0;
+}
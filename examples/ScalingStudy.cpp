@@ -0,0 +1,108 @@
+#include <Cajita.hpp>
+#include <PFHub.hpp>
+
+#include <chrono>
+#include <cmath>
+
+using namespace CabanaPF;
+
+/*Strong and weak scaling of the PFHub1a step loop.  For each rank count, the first ranks of MPI_COMM_WORLD are split
+off into a sub-communicator that runs the simulation while the rest wait.
+    -strong: the global grid is fixed at N x N
+    -weak: the points per rank are fixed, so the grid is N*sqrt(P/P0) on a side (P0 is the first rank count)
+Prints the time per step, the parallel efficiency relative to the first rank count, and how the step is split between
+the FFTs (fft_forward and fft_inverse, which include heFFTe's communication) and the local kernels.*/
+namespace {
+
+struct Result {
+    double step;    //seconds per step (slowest rank)
+    double fft;
+    double local;
+};
+
+double slowest(double value, MPI_Comm comm) {
+    double result;
+    MPI_Allreduce(&value, &result, 1, MPI_DOUBLE, MPI_MAX, comm);
+    return result;
+}
+
+Result run(const int grid_points, const int timesteps, MPI_Comm comm) {
+    //the first half of the steps is timed as a whole, the second half per phase (which adds fences)
+    PFHub1aPeriodic simulation(grid_points, 2*timesteps, comm);
+    simulation.timestep(0);
+
+    MPI_Barrier(comm);
+    const auto start = std::chrono::steady_clock::now();
+    simulation.timestep(timesteps);
+    Kokkos::fence();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto& timers = simulation.phase_timers();
+    timers.enable(true);
+    simulation.timestep(timesteps);
+    Result result;
+    result.step = slowest(elapsed / timesteps, comm);
+    result.fft = slowest((timers.total("fft_forward") + timers.total("fft_inverse")) / timesteps, comm);
+    result.local = slowest((timers.total("pre_step") + timers.total("spectral_update")) / timesteps, comm);
+    return result;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    MPI_Init( &argc, &argv );
+    {
+        bind_device();  //before Kokkos picks a GPU
+        Kokkos::ScopeGuard scope_guard( argc, argv );
+        int world_rank, world_size;
+        MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+        std::string mode;
+        int grid_points, timesteps;
+        std::vector<int> rank_counts;
+        try {
+            if (argc < 5)
+                throw std::invalid_argument("too few arguments");
+            mode = argv[1];
+            if (mode != "strong" && mode != "weak")
+                throw std::invalid_argument("unknown mode");
+            grid_points = std::stoi(argv[2]);
+            timesteps = std::stoi(argv[3]);
+            for (int i=4; i<argc; i++) {
+                rank_counts.push_back(std::stoi(argv[i]));
+                if (rank_counts.back() > world_size)
+                    throw std::invalid_argument("more ranks requested than available");
+            }
+        } catch (std::logic_error&) {
+            if (0 == world_rank)
+                std::cout << "Usage: ./ScalingStudy strong|weak grid_points timesteps ranks [ranks ...]" << std::endl;
+            return 1;
+        }
+
+        if (0 == world_rank)
+            std::cout << mode << " scaling\nnum_rank grid_points step(s) efficiency fft(s) local(s) fft_fraction" << std::endl;
+        Result first{0, 0, 0};
+        for (std::size_t r=0; r<rank_counts.size(); r++) {
+            const int ranks = rank_counts[r];
+            const int points = mode == "strong" ? grid_points
+                : 2*static_cast<int>(std::round(grid_points * std::sqrt(static_cast<double>(ranks)/rank_counts[0]) / 2));
+            MPI_Comm comm;
+            MPI_Comm_split(MPI_COMM_WORLD, world_rank < ranks ? 0 : MPI_UNDEFINED, world_rank, &comm);
+            if (comm != MPI_COMM_NULL) {
+                const Result result = run(points, timesteps, comm);
+                if (r == 0)
+                    first = result;
+                //strong: the work per rank shrinks, so compare total rank-seconds; weak: it stays the same, so compare time
+                const double efficiency = mode == "strong" ? first.step*rank_counts[0] / (result.step*ranks) : first.step / result.step;
+                if (0 == world_rank)
+                    std::cout << ranks << " " << points << " " << result.step << " " << efficiency << " " << result.fft
+                        << " " << result.local << " " << result.fft/(result.fft + result.local) << std::endl;
+                MPI_Comm_free(&comm);
+            }
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+    MPI_Finalize();
+    return 0;
+}
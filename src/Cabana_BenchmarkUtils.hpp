@@ -32,16 +32,19 @@ namespace Benchmark
 // the parameter sweep) for each timer to allow for parametric sweeps. Each
 // timer can do multiple runs over each data point in the parameter sweep. The
 // name of the data point and its values can then be injected into the output
-// table.
+// table. A fenced timer calls Kokkos::fence() when starting and stopping, so
+// that asynchronous (e.g. GPU) work is included in the measurement.
 class Timer
 {
   public:
     // Create the timer.
-    Timer( const std::string& name, const int num_data )
+    Timer( const std::string& name, const int num_data,
+           const bool fence = false )
         : _name( name )
         , _starts( num_data )
         , _data( num_data )
         , _is_stopped( num_data, true )
+        , _fence( fence )
     {
     }
 
@@ -50,6 +53,8 @@ class Timer
     {
         if ( !_is_stopped[data_point] )
             throw std::logic_error( "attempted to start a running timer" );
+        if ( _fence )
+            Kokkos::fence();
         _starts[data_point] = std::chrono::high_resolution_clock::now();
         _is_stopped[data_point] = false;
     }
@@ -59,6 +64,8 @@ class Timer
     {
         if ( _is_stopped[data_point] )
             throw std::logic_error( "attempted to stop a stopped timer" );
+        if ( _fence )
+            Kokkos::fence();
         auto now = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double, std::micro> fp_micro =
             now - _starts[data_point];
@@ -71,6 +78,7 @@ class Timer
     std::vector<std::chrono::high_resolution_clock::time_point> _starts;
     std::vector<std::vector<double>> _data;
     std::vector<bool> _is_stopped;
+    bool _fence;
 };
 
 //---------------------------------------------------------------------------//
@@ -178,6 +186,108 @@ void outputResults( std::ostream& stream, const std::string& data_point_name,
 }
 #endif
 
+//---------------------------------------------------------------------------//
+// Summary statistics of a set of samples. Percentiles are linearly
+// interpolated between the sorted samples.
+struct Statistics
+{
+    double min = 0.0;
+    double max = 0.0;
+    double mean = 0.0;
+    double median = 0.0;
+    double p10 = 0.0;
+    double p90 = 0.0;
+    std::size_t count = 0;
+};
+
+inline double percentile( const std::vector<double>& sorted,
+                          const double fraction )
+{
+    if ( sorted.empty() )
+        return 0.0;
+    double position = fraction * ( sorted.size() - 1 );
+    std::size_t below = static_cast<std::size_t>( position );
+    std::size_t above = std::min( below + 1, sorted.size() - 1 );
+    double weight = position - below;
+    return ( 1.0 - weight ) * sorted[below] + weight * sorted[above];
+}
+
+inline Statistics computeStatistics( std::vector<double> samples )
+{
+    Statistics stats;
+    stats.count = samples.size();
+    if ( samples.empty() )
+        return stats;
+    std::sort( samples.begin(), samples.end() );
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.mean = std::accumulate( samples.begin(), samples.end(), 0.0 ) /
+                 samples.size();
+    stats.median = percentile( samples, 0.5 );
+    stats.p10 = percentile( samples, 0.1 );
+    stats.p90 = percentile( samples, 0.9 );
+    return stats;
+}
+
+//---------------------------------------------------------------------------//
+// Parallel statistics.
+// Gather the samples from every rank (each rank must provide the same number)
+// and compute statistics over all of them. The result is only valid on rank
+// 0. This function does collective communication.
+#ifdef Cabana_ENABLE_MPI
+inline Statistics gatherStatistics( const std::vector<double>& samples,
+                                    MPI_Comm comm )
+{
+    int comm_rank;
+    MPI_Comm_rank( comm, &comm_rank );
+    int comm_size;
+    MPI_Comm_size( comm, &comm_size );
+
+    std::vector<double> all_samples;
+    if ( 0 == comm_rank )
+        all_samples.resize( samples.size() * comm_size );
+    MPI_Gather( samples.data(), samples.size(), MPI_DOUBLE,
+                all_samples.data(), samples.size(), MPI_DOUBLE, 0, comm );
+    return computeStatistics( all_samples );
+}
+
+//---------------------------------------------------------------------------//
+// Parallel CSV output.
+// Write timer results on rank 0 as comma-separated values, with statistics
+// over the samples from all ranks: one header line, then one line per data
+// point. This function does collective communication.
+template <class Scalar>
+void outputResultsCSV( std::ostream& stream, const std::string& data_point_name,
+                       const std::vector<Scalar>& data_point_vals,
+                       const Timer& timer, MPI_Comm comm )
+{
+    int comm_rank;
+    MPI_Comm_rank( comm, &comm_rank );
+    int comm_size;
+    MPI_Comm_size( comm, &comm_size );
+
+    if ( 0 == comm_rank )
+        stream << "timer,num_rank," << data_point_name
+               << ",min,max,mean,median,p10,p90\n";
+
+    for ( std::size_t n = 0; n < timer._data.size(); ++n )
+    {
+        if ( !timer._is_stopped[n] )
+            throw std::logic_error(
+                "attempted to output from a running timer" );
+
+        Statistics stats = gatherStatistics( timer._data[n], comm );
+        if ( 0 == comm_rank )
+        {
+            stream << timer._name << "," << comm_size << ","
+                   << data_point_vals[n] << "," << stats.min << ","
+                   << stats.max << "," << stats.mean << "," << stats.median
+                   << "," << stats.p10 << "," << stats.p90 << "\n";
+        }
+    }
+}
+#endif
+
 //---------------------------------------------------------------------------//
 
 } // end namespace Benchmark
@@ -0,0 +1,235 @@
+#ifndef CAHNHILLIARD_H
+#define CAHNHILLIARD_H
+
+#include <Cajita.hpp>
+#include <PFHub.hpp>
+#include <PFVariables.hpp>
+#include <Runner.hpp>
+#include <SpectralOperators.hpp>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace CabanaPF {
+
+//The free energy f = RHO*(c-C_ALPHA)^2*(C_BETA-c)^2 + KAPPA/2*|grad c|^2, the mobility, and the domain; PFHub1a's by default
+struct CahnHilliardParameters {
+    double size = PFHub1aBase::_SIZE;       //length of the (cubic) domain's sides
+    double end_time = PFHub1aBase::END_TIME;
+    double kappa = PFHub1aBase::_KAPPA;
+    double mobility = PFHub1aBase::_M;
+    double rho = PFHub1aBase::_RHO;
+    double c_alpha = PFHub1aBase::_C_ALPHA;
+    double c_beta = PFHub1aBase::_C_BETA;
+
+    //The chemical potential from the bulk free energy
+    KOKKOS_INLINE_FUNCTION double df_dc(const double c) const {
+        return rho * (2.0*(c-c_alpha)*(c_beta-c)*(c_beta-c) - 2.0*(c_beta-c)*(c-c_alpha)*(c-c_alpha));
+    }
+};
+
+/*Spectral Cahn-Hilliard with the semi-implicit update of PFHub1a, in 2D or 3D.  This is written for grids where memory
+is what limits the run (e.g. 1024^3): c is the only stored field.  df_dc is computed while c is packed for the forward
+FFT and goes straight into its spectrum, so it never has a real space field of its own; the FFT's work buffer is the
+only real space scratch, and is shared by both.  The propagator is computed from the wavenumbers inside the update
+kernel instead of being stored, so there are no k^2, k^4, or factor arrays.  All in, that is one field, two half
+spectra, and the FFT's buffers, without the operator and propagator arrays PFHub1aBase also keeps.  Only the fixed timestep
+END_TIME/timesteps, and no diagnostics.  See PeriodicCahnHilliard for initial conditions.*/
+template <std::size_t NumSpaceDim, class Scalar = double>
+class CahnHilliard : public CabanaPFRunner<NumSpaceDim> {
+protected:
+    using cscalar = Kokkos::complex<Scalar>;
+    using exec_space = typename CabanaPFRunner<NumSpaceDim>::exec_space;
+
+    const CahnHilliardParameters parameters;
+    const double cell_size;
+    const double dt;
+
+    //c_hat = c_hat/(1 + dt*M*KAPPA*k^4) - dt*M*k^2*df_dc_hat/(1 + dt*M*KAPPA*k^4), at a point with |k|^2 = k2
+    static KOKKOS_INLINE_FUNCTION void propagate(const double k2, const double dt, const CahnHilliardParameters& p,
+        cscalar& c_hat, const cscalar& df_dc_hat)
+    {
+        const double inverse_denominator = 1.0 / (1.0 + dt*p.mobility*p.kappa*(k2*k2));
+        const Scalar c_factor = inverse_denominator;
+        const Scalar dfdc_factor = -dt*p.mobility*k2*inverse_denominator;
+        c_hat = c_factor*c_hat + dfdc_factor*df_dc_hat;
+    }
+
+    //Semi-implicit update of c_hat, once both spectra are available
+    void spectral_update() {
+        const auto c_hat = vars.spectrum(0);
+        const auto df_dc_hat = vars.spectrum(1);
+        const auto offset = vars.spectrum_offset();
+        const int points = this->grid_points;
+        const double step_dt = dt;
+        const CahnHilliardParameters p = parameters;
+        if constexpr (NumSpaceDim == 3) {
+            const int x0 = offset[0], y0 = offset[1], z0 = offset[2];
+            this->spectral_parallel_for("timestep", c_hat, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const double kx = SpectralOperators<3>::wavenumber(i + x0, points, p.size);
+                const double ky = SpectralOperators<3>::wavenumber(j + y0, points, p.size);
+                const double kz = SpectralOperators<3>::wavenumber(k + z0, points, p.size);
+                propagate(kx*kx + ky*ky + kz*kz, step_dt, p, c_hat(i, j, k), df_dc_hat(i, j, k));
+            });
+        } else {
+            const int x0 = offset[0], y0 = offset[1];
+            this->spectral_parallel_for("timestep", c_hat, KOKKOS_LAMBDA(const int i, const int j) {
+                const double kx = SpectralOperators<2>::wavenumber(i + x0, points, p.size);
+                const double ky = SpectralOperators<2>::wavenumber(j + y0, points, p.size);
+                propagate(kx*kx + ky*ky, step_dt, p, c_hat(i, j), df_dc_hat(i, j));
+            });
+        }
+    }
+
+public:
+    PFVariables<NumSpaceDim, 1, Scalar, 2> vars;    //c, with spectra for c and df_dc
+
+    CahnHilliard(int grid_points, int timesteps, const CahnHilliardParameters& parameters = CahnHilliardParameters(),
+            MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<NumSpaceDim>& decomposition = Decomposition<NumSpaceDim>())
+        : CabanaPFRunner<NumSpaceDim>(grid_points, timesteps, parameters.size, 1, comm, decomposition),
+        parameters{parameters}, cell_size{parameters.size/grid_points}, dt{parameters.end_time/timesteps},
+        vars{this->layout, {"c"}, decomposition.fft, this->arena}
+    {}
+
+    //Problem-specific initial conditions
+    virtual void initial_conditions()=0;
+    //Prefix for this run's output files
+    virtual std::string run_name() const=0;
+
+    double timestep_size() const {
+        return dt;
+    }
+
+    double simulation_time() const override {
+        return this->timesteps_done * dt;
+    }
+
+    //Every timestep is the same kernels and FFTs
+    bool capturable() const override {
+        return true;
+    }
+
+    std::string fft_plan() const {
+        return vars.fft_plan();
+    }
+
+    auto get_cpu_view() {
+        return vars.host_view(0);
+    }
+
+    //Write c and the step count so far to a checkpoint named after run_name, for restart()
+    void checkpoint(const std::string& run_name, const bool async = false) {
+        this->timers.start("io");
+        vars.checkpoint(run_name, {this->timesteps_done, dt, simulation_time()}, async);
+        this->timers.stop("io");
+    }
+
+    void wait_for_output() {
+        vars.wait_for_output();
+    }
+
+    //Continue from the checkpoint written after from_timestep timesteps, instead of from the initial conditions
+    void restart(const std::string& run_name, const int from_timestep) {
+        this->timers.start("io");
+        const auto info = vars.restart(run_name, from_timestep);
+        this->timers.stop("io");
+        if (info.dt != dt)
+            throw std::runtime_error("Checkpoint " + run_name + " was written with a different timestep size");
+        this->timesteps_done = info.timesteps_done;
+        this->have_initialized = true;
+    }
+
+    void output() {
+        this->timers.start("io");
+        vars.save(0, run_name());
+        this->timers.stop("io");
+    }
+
+    //Called by the output schedule: writes c, with the timestep in the file name
+    void snapshot() override {
+        vars.snapshot(0, run_name(), this->timesteps_done, simulation_time());
+    }
+
+    void initialize() override {
+        initial_conditions();
+    }
+
+    //The whole timestep happens here and in post_step, fused or not: df_dc only exists inside the forward FFT
+    void step() override {
+        const auto c_view = vars[0];
+        const CahnHilliardParameters p = parameters;
+        this->timers.start("fft_forward");
+        if constexpr (NumSpaceDim == 3) {
+            vars.template fft_forward_fused<2>(0, KOKKOS_LAMBDA(const int i, const int j, const int k, Kokkos::Array<double, 2>& values) {
+                values[0] = c_view(i, j, k, 0);
+                values[1] = p.df_dc(values[0]);
+            });
+        } else {
+            vars.template fft_forward_fused<2>(0, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, 2>& values) {
+                values[0] = c_view(i, j, 0);
+                values[1] = p.df_dc(values[0]);
+            });
+        }
+        this->timers.stop("fft_forward");
+        this->timers.start("spectral_update");
+        spectral_update();
+        this->timers.stop("spectral_update");
+    }
+
+    void post_step() override {
+        this->timers.start("fft_inverse");
+        vars.fft_inverse(0);
+        this->timers.stop("fft_inverse");
+    }
+};
+
+/*PFHub1aPeriodic's initial conditions on CahnHilliard: in 2D, exactly PFHub1aPeriodic (so the two should agree), and
+in 3D, the same terms each varied along z as well, still periodic on the domain.  Solver picks the discretization:
+CahnHilliard (spectral), or FiniteDifferenceCahnHilliard (stencils with halo exchange, see FiniteDifference.hpp).*/
+template <std::size_t NumSpaceDim, class Scalar = double, template <std::size_t, class> class Solver = CahnHilliard>
+class PeriodicCahnHilliard final : public StaticTimestep<PeriodicCahnHilliard<NumSpaceDim, Scalar, Solver>, Solver<NumSpaceDim, Scalar>> {
+    using Static = StaticTimestep<PeriodicCahnHilliard<NumSpaceDim, Scalar, Solver>, Solver<NumSpaceDim, Scalar>>;
+public:
+    //c at the start, at position (x, y, z)
+    static KOKKOS_INLINE_FUNCTION double initial_c(const double x, const double y, const double z) {
+        return .5 + .01*(Kokkos::cos(3*M_PI*x/100)*Kokkos::cos(M_PI*y/25)*Kokkos::cos(M_PI*z/50)
+            + Kokkos::cos(M_PI*x/25)*Kokkos::cos(3*M_PI*y/100)*Kokkos::cos(M_PI*x/25)*Kokkos::cos(3*M_PI*y/100)*Kokkos::cos(M_PI*z/25)
+            + Kokkos::cos(M_PI*x/100-M_PI*y/20+M_PI*z/100)*Kokkos::cos(M_PI*x/50-M_PI*y/100-M_PI*z/50));
+    }
+
+    void initial_conditions() override {
+        const auto c = this->vars[0];   //get View for scope capture
+        const auto delta = this->cell_size;
+        const auto offset = this->local_to_global();
+        const int x0 = offset[0], y0 = offset[1];
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = offset[2];
+            this->node_parallel_for("periodic initial conditions", KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                c(i, j, k, 0) = initial_c(delta*(i + x0), delta*(j + y0), delta*(k + z0));
+            });
+        } else {
+            this->node_parallel_for("periodic initial conditions", KOKKOS_LAMBDA(const int i, const int j) {
+                c(i, j, 0) = BasicPFHub1aPeriodic<Scalar>::initial_c(delta*(i + x0), delta*(j + y0));
+            });
+        }
+    }
+
+    //e.g. 1aPeriodic3D_N256T500
+    static std::string run_name_for(const int grid_points, const int timesteps) {
+        std::stringstream s;
+        s << "1aPeriodic" << NumSpaceDim << "D_N" << grid_points << "T" << timesteps;
+        return s.str();
+    }
+
+    std::string run_name() const override {
+        return run_name_for(this->grid_points, this->timesteps);
+    }
+
+    PeriodicCahnHilliard(int grid_points, int timesteps, const CahnHilliardParameters& parameters = CahnHilliardParameters(),
+            MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<NumSpaceDim>& decomposition = Decomposition<NumSpaceDim>())
+        : Static{grid_points, timesteps, parameters, comm, decomposition} {}
+};
+
+}
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <Cajita.hpp>
+#include <mpi.h>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace CabanaPF {
+
+//What a restart needs besides the fields themselves
+struct CheckpointInfo {
+    int timesteps_done = 0;
+    double dt = 0;
+    double time = 0;
+};
+
+/*Parallel binary checkpoints of the owned nodes of a set of Cajita arrays that share a layout.  The file is a
+fixed-size header followed by each array as one global block, dofs fastest, then x, y, (and z), with no periodic
+seam.  Every rank packs its owned block on the device, copies it to the host in one go, and writes (or reads) it
+with a single collective MPI-IO call per array, so it works the same on GPUs and scales with the rank count.
+write_async writes the same format in the background (see below).*/
+template <std::size_t NumSpaceDim>
+class Checkpoint {
+    using execution_space = Kokkos::DefaultExecutionSpace;
+    using memory_space = typename execution_space::memory_space;
+    using Mesh = Cajita::UniformMesh<double, NumSpaceDim>;
+    using Buffer_type = Kokkos::View<double*, memory_space>;
+    //page-locked host memory, so the device to host copy can run asynchronously
+#if defined(KOKKOS_ENABLE_CUDA)
+    using pinned_space = std::conditional_t<std::is_same_v<execution_space, Kokkos::Cuda>, Kokkos::CudaHostPinnedSpace, Kokkos::HostSpace>;
+#elif defined(KOKKOS_ENABLE_HIP)
+    using pinned_space = std::conditional_t<std::is_same_v<execution_space, Kokkos::Experimental::HIP>,
+        Kokkos::Experimental::HIPHostPinnedSpace, Kokkos::HostSpace>;
+#else
+    using pinned_space = Kokkos::HostSpace;
+#endif
+    using Staging_type = Kokkos::View<double*, memory_space>;
+    using Pinned_type = decltype(Kokkos::create_mirror_view(pinned_space(), Staging_type()));
+
+    struct Header {
+        char magic[8];
+        int version;
+        int space_dim;
+        int variables;
+        int dofs;
+        long global_size[3];
+        int timesteps_done;
+        double dt;
+        double time;
+    };
+    static constexpr MPI_Offset header_bytes = 256;     //room to grow the header without moving the data
+    static_assert(sizeof(Header) <= header_bytes);
+    static constexpr char magic[8] = {'C', 'a', 'b', 'a', 'n', 'a', 'P', 'F'};
+    static constexpr int version = 1;
+
+    MPI_Comm comm;
+    int dofs;
+    Cajita::IndexSpace<NumSpaceDim> own_space;  //owned nodes, in local indices
+    std::array<long, NumSpaceDim> global_size;
+    std::array<int, NumSpaceDim> global_offset;
+    MPI_Datatype block_type;    //this rank's block of one global array
+    Buffer_type buffer;         //owned values, packed in file order
+
+    //for write_async: a device snapshot of every array, its host copy, and the thread writing it out
+    execution_space copy_space;
+    Staging_type staging;
+    Pinned_type pinned;
+    std::thread writer;
+    std::string writer_error;   //set by the writer thread if it fails, and thrown by wait()
+
+    MPI_Offset array_offset(const int index) const {
+        long points = dofs;
+        for (std::size_t d=0; d<NumSpaceDim; d++)
+            points *= global_size[d];
+        return header_bytes + index*points*static_cast<MPI_Offset>(sizeof(double));
+    }
+
+    static void check(const int error, const std::string& what, const std::string& file_name) {
+        if (error != MPI_SUCCESS) {
+            char message[MPI_MAX_ERROR_STRING];
+            int length;
+            MPI_Error_string(error, message, &length);
+            throw std::runtime_error("Checkpoint " + file_name + ": " + what + " failed: " + std::string(message, length));
+        }
+    }
+
+    template <class View_t>
+    void pack(const View_t& view, const Buffer_type& packed) {
+        const int n = dofs;
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("checkpoint pack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const long w = (i-x0) + nx*((j-y0) + static_cast<long>(ny)*(k-z0));
+                for (int d=0; d<n; d++)
+                    packed(n*w+d) = view(i, j, k, d);
+            });
+        } else {
+            Cajita::grid_parallel_for("checkpoint pack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const long w = (i-x0) + static_cast<long>(nx)*(j-y0);
+                for (int d=0; d<n; d++)
+                    packed(n*w+d) = view(i, j, d);
+            });
+        }
+    }
+
+    template <class View_t>
+    void unpack(const View_t& view, const Buffer_type& packed) {
+        const int n = dofs;
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("checkpoint unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const long w = (i-x0) + nx*((j-y0) + static_cast<long>(ny)*(k-z0));
+                for (int d=0; d<n; d++)
+                    view(i, j, k, d) = packed(n*w+d);
+            });
+        } else {
+            Cajita::grid_parallel_for("checkpoint unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const long w = (i-x0) + static_cast<long>(nx)*(j-y0);
+                for (int d=0; d<n; d++)
+                    view(i, j, d) = packed(n*w+d);
+            });
+        }
+    }
+
+    //Open file_name for writing Count arrays (truncating it if it exists) and write the header
+    template <std::size_t Count>
+    MPI_File create(const std::string& file_name, const CheckpointInfo& info) {
+        MPI_File file;
+        check(MPI_File_open(comm, file_name.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file), "open", file_name);
+        check(MPI_File_set_size(file, 0), "truncate", file_name);
+        check(MPI_File_set_size(file, array_offset(Count)), "resize", file_name);
+
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        if (0 == rank) {
+            Header header{};
+            std::memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            header.space_dim = NumSpaceDim;
+            header.variables = Count;
+            header.dofs = dofs;
+            for (std::size_t d=0; d<3; d++)
+                header.global_size[d] = d < NumSpaceDim ? global_size[d] : 1;
+            header.timesteps_done = info.timesteps_done;
+            header.dt = info.dt;
+            header.time = info.time;
+            check(MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE), "header write", file_name);
+        }
+        return file;
+    }
+
+    //Runs on the writer thread: wait for the host copy, then write each owned row of each array in place
+    void write_pinned(const std::string& file_name, const int count) {
+        try {
+            copy_space.fence();
+            std::fstream file(file_name, std::fstream::in | std::fstream::out | std::fstream::binary);
+            if (!file)
+                throw std::runtime_error("could not open " + file_name);
+            const long nx = own_space.extent(0), ny = own_space.extent(1);
+            const long nz = NumSpaceDim == 3 ? own_space.extent(NumSpaceDim-1) : 1;
+            const long block = dofs*own_space.size();
+            for (int index=0; index<count; index++) {
+                for (long k=0; k<nz; k++) {
+                    for (long j=0; j<ny; j++) {
+                        long row = global_offset[1] + j;
+                        if constexpr (NumSpaceDim == 3)
+                            row += global_size[1]*(global_offset[2] + k);
+                        const MPI_Offset offset = array_offset(index) + dofs*(row*global_size[0] + global_offset[0])*sizeof(double);
+                        file.seekp(offset);
+                        file.write(reinterpret_cast<const char*>(pinned.data() + index*block + dofs*(j + ny*k)*nx), dofs*nx*sizeof(double));
+                    }
+                }
+            }
+            if (!file)
+                throw std::runtime_error("write to " + file_name + " failed");
+        } catch (std::exception& e) {
+            writer_error = e.what();
+        }
+    }
+
+public:
+    Checkpoint(const Cajita::ArrayLayout<Cajita::Node, Mesh>& layout) : dofs{layout.dofsPerEntity()},
+        copy_space{Kokkos::Experimental::partition_space(execution_space(), 1)[0]}
+    {
+        const auto local_grid = layout.localGrid();
+        const auto& global_grid = local_grid->globalGrid();
+        comm = global_grid.comm();
+        own_space = local_grid->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local());
+
+        //MPI's Fortran order makes the first index (the dof) fastest
+        int sizes[NumSpaceDim+1], subsizes[NumSpaceDim+1], starts[NumSpaceDim+1];
+        sizes[0] = subsizes[0] = dofs;
+        starts[0] = 0;
+        for (std::size_t d=0; d<NumSpaceDim; d++) {
+            global_size[d] = global_grid.globalNumEntity(Cajita::Node(), d);
+            global_offset[d] = global_grid.globalOffset(d);
+            sizes[d+1] = global_size[d];
+            subsizes[d+1] = own_space.extent(d);
+            starts[d+1] = global_offset[d];
+        }
+        MPI_Type_create_subarray(NumSpaceDim+1, sizes, subsizes, starts, MPI_ORDER_FORTRAN, MPI_DOUBLE, &block_type);
+        MPI_Type_commit(&block_type);
+        buffer = Buffer_type(Kokkos::ViewAllocateWithoutInitializing("checkpoint buffer"), dofs*own_space.size());
+    }
+
+    ~Checkpoint() {
+        if (writer.joinable())
+            writer.join();
+        MPI_Type_free(&block_type);
+    }
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    //Collective: write every array (in order) and the restart info to file_name, replacing it if it exists
+    template <class Array_t, std::size_t Count>
+    void write(const std::string& file_name, const std::array<Array_t, Count>& arrays, const CheckpointInfo& info) {
+        wait();
+        MPI_File file = create<Count>(file_name, info);
+        for (std::size_t index=0; index<Count; index++) {
+            pack(arrays[index]->view(), buffer);
+            const auto host = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), buffer);
+            check(MPI_File_set_view(file, array_offset(index), MPI_DOUBLE, block_type, "native", MPI_INFO_NULL), "set view", file_name);
+            check(MPI_File_write_all(file, host.data(), host.size(), MPI_DOUBLE, MPI_STATUS_IGNORE), "write", file_name);
+        }
+        MPI_File_close(&file);
+    }
+
+    /*Collective, like write, but only takes a snapshot of the arrays on the device before returning.  The snapshot
+    is copied to pinned host memory on a separate execution space instance, and then written by a background thread
+    (with plain file I/O, so MPI need not be thread safe), overlapping with whatever the caller does next.  Only
+    one write is in flight at a time: this first waits for the previous one.*/
+    template <class Array_t, std::size_t Count>
+    void write_async(const std::string& file_name, const std::array<Array_t, Count>& arrays, const CheckpointInfo& info) {
+        wait();
+        MPI_File file = create<Count>(file_name, info);
+        MPI_File_close(&file);  //the file exists with its header on every rank once this returns
+
+        const long block = dofs*own_space.size();
+        if (staging.size() < Count*block) {
+            staging = Staging_type(Kokkos::ViewAllocateWithoutInitializing("checkpoint staging"), Count*block);
+            pinned = Kokkos::create_mirror_view(pinned_space(), staging);
+        }
+        for (std::size_t index=0; index<Count; index++)
+            pack(arrays[index]->view(), Kokkos::subview(staging, std::make_pair(index*block, (index+1)*block)));
+        //the copy must not start until the snapshot is taken, but the main stream is then free to move on
+        execution_space().fence();
+        if (pinned.data() != staging.data())
+            Kokkos::deep_copy(copy_space, pinned, staging);
+        writer = std::thread(&Checkpoint::write_pinned, this, file_name, static_cast<int>(Count));
+    }
+
+    //Block until the last write_async has reached the file; throws if it failed
+    void wait() {
+        if (writer.joinable())
+            writer.join();
+        if (!writer_error.empty()) {
+            const std::string error = writer_error;
+            writer_error.clear();
+            throw std::runtime_error("Checkpoint: " + error);
+        }
+    }
+
+    /*Collective: read every array (in order) from a file written by write(), and return its restart info.  The
+    file must hold the same number of arrays on the same global grid, but may have been written by any number of ranks.*/
+    template <class Array_t, std::size_t Count>
+    CheckpointInfo read(const std::string& file_name, const std::array<Array_t, Count>& arrays) {
+        wait();
+        MPI_File file;
+        check(MPI_File_open(comm, file_name.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file), "open", file_name);
+
+        //every rank reads the (tiny) header, so every rank can check it
+        Header header;
+        check(MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE), "header read", file_name);
+        bool matches = std::memcmp(header.magic, magic, sizeof(magic)) == 0 && header.version == version
+            && header.space_dim == static_cast<int>(NumSpaceDim) && header.variables == static_cast<int>(Count) && header.dofs == dofs;
+        for (std::size_t d=0; d<NumSpaceDim; d++)
+            matches = matches && header.global_size[d] == global_size[d];
+        if (!matches) {
+            MPI_File_close(&file);
+            throw std::runtime_error("Checkpoint " + file_name + " does not match this simulation's grid and variables");
+        }
+
+        const auto host = Kokkos::create_mirror_view(Kokkos::HostSpace(), buffer);
+        for (std::size_t index=0; index<Count; index++) {
+            check(MPI_File_set_view(file, array_offset(index), MPI_DOUBLE, block_type, "native", MPI_INFO_NULL), "set view", file_name);
+            check(MPI_File_read_all(file, host.data(), host.size(), MPI_DOUBLE, MPI_STATUS_IGNORE), "read", file_name);
+            Kokkos::deep_copy(buffer, host);
+            unpack(arrays[index]->view(), buffer);
+        }
+        MPI_File_close(&file);
+
+        CheckpointInfo info;
+        info.timesteps_done = header.timesteps_done;
+        info.dt = header.dt;
+        info.time = header.time;
+        return info;
+    }
+};
+
+}
+
+#endif
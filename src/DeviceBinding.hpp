@@ -0,0 +1,150 @@
+#ifndef DEVICEBINDING_H
+#define DEVICEBINDING_H
+
+#include <Kokkos_Core.hpp>
+#include <StepGraph.hpp>
+#include <mpi.h>
+
+#if defined(OPEN_MPI) && __has_include(<mpi-ext.h>)
+#include <mpi-ext.h>    //Open MPI's MPIX_Query_cuda_support and MPIX_Query_rocm_support
+#endif
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace CabanaPF {
+
+//Where this rank runs, as far as the launcher and MPI library say
+struct DeviceBinding {
+    int local_rank = 0;     //among the ranks on this node
+    int local_size = 1;
+    int devices = 0;        //GPUs visible to this rank (0 without CUDA/HIP)
+    int device = -1;        //the one it should use, or -1 if none
+    bool gpu_aware_mpi = false;     //whether MPI can be handed device pointers
+};
+
+namespace Impl {
+
+//The node-local rank from the launcher's environment, without any MPI calls; -1 if no known launcher set one
+inline int launcher_local_rank() {
+    for (const char* name : {"OMPI_COMM_WORLD_LOCAL_RANK", "MV2_COMM_WORLD_LOCAL_RANK", "MPI_LOCALRANKID",
+            "PALS_LOCAL_RANKID", "PMI_LOCAL_RANK", "SLURM_LOCALID"}) {
+        if (const char* value = std::getenv(name))
+            return std::atoi(value);
+    }
+    return -1;
+}
+
+inline int visible_devices() {
+    int count = 0;
+#if defined(KOKKOS_ENABLE_CUDA)
+    if (cudaGetDeviceCount(&count) != cudaSuccess)
+        count = 0;
+#elif defined(KOKKOS_ENABLE_HIP)
+    if (hipGetDeviceCount(&count) != hipSuccess)
+        count = 0;
+#endif
+    return count;
+}
+
+}
+
+/*Whether the MPI library accepts device pointers, which heFFTe's reshapes hand it unless told otherwise (see
+FFTOptions::use_gpu_aware).  CABANAPF_GPU_AWARE_MPI=0 or 1 overrides the detection.  Otherwise Open MPI and MPICH are
+asked, then Cray MPICH's MPICH_GPU_SUPPORT_ENABLED is read; if none of them can say, it is assumed, as the README
+requires.  Always false on CPU builds.*/
+inline bool gpu_aware_mpi() {
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP)
+    static const bool aware = []() {
+        if (const char* value = std::getenv("CABANAPF_GPU_AWARE_MPI"))
+            return std::string(value) != "0";
+#if defined(KOKKOS_ENABLE_CUDA) && defined(MPIX_CUDA_AWARE_SUPPORT)
+        return MPIX_Query_cuda_support() == 1;
+#elif defined(KOKKOS_ENABLE_HIP) && defined(MPIX_ROCM_AWARE_SUPPORT)
+        return MPIX_Query_rocm_support() == 1;
+#elif defined(MPIX_GPU_SUPPORT_CUDA)
+        int supported = 0;
+#if defined(KOKKOS_ENABLE_CUDA)
+        MPIX_GPU_query_support(MPIX_GPU_SUPPORT_CUDA, &supported);
+#else
+        MPIX_GPU_query_support(MPIX_GPU_SUPPORT_HIP, &supported);
+#endif
+        return supported == 1;
+#else
+        if (const char* value = std::getenv("MPICH_GPU_SUPPORT_ENABLED"))
+            return std::string(value) == "1";
+        return true;
+#endif
+    }();
+    return aware;
+#else
+    return false;
+#endif
+}
+
+/*Find this rank's place on its node and the GPU it should use: the node-local rank modulo the visible devices, so
+ranks spread over the node's GPUs rather than all landing on the first.  Collective over comm.  Call before
+Kokkos::initialize, e.g. through bind_device.*/
+inline DeviceBinding detect_device_binding(MPI_Comm comm = MPI_COMM_WORLD) {
+    DeviceBinding binding;
+    MPI_Comm node;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &binding.local_rank);
+    MPI_Comm_size(node, &binding.local_size);
+    MPI_Comm_free(&node);
+    //the launcher's numbering, which check_device_binding goes by, but only if it counts the same ranks as comm does
+    int congruence;
+    MPI_Comm_compare(comm, MPI_COMM_WORLD, &congruence);
+    if ((congruence == MPI_IDENT || congruence == MPI_CONGRUENT) && Impl::launcher_local_rank() >= 0)
+        binding.local_rank = Impl::launcher_local_rank();
+    binding.devices = Impl::visible_devices();
+    if (binding.devices > 0)
+        binding.device = binding.local_rank % binding.devices;
+    binding.gpu_aware_mpi = gpu_aware_mpi();
+    return binding;
+}
+
+/*Have Kokkos use this rank's GPU (see detect_device_binding), by setting KOKKOS_DEVICE_ID for Kokkos::initialize to
+pick up; a device ID already given, there or as --kokkos-device-id, wins.  Rank 0 warns if there are more ranks on
+its node than GPUs, since they then share.  Call between MPI_Init and Kokkos::initialize.*/
+inline DeviceBinding bind_device(MPI_Comm comm = MPI_COMM_WORLD) {
+    const auto binding = detect_device_binding(comm);
+    if (binding.device >= 0)
+        setenv("KOKKOS_DEVICE_ID", std::to_string(binding.device).c_str(), 0);
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (0 == rank && binding.devices > 0 && binding.local_size > binding.devices)
+        std::cerr << "CabanaPF: " << binding.local_size << " ranks per node share " << binding.devices << " GPUs" << std::endl;
+    if (0 == rank && binding.devices > 0 && !binding.gpu_aware_mpi)
+        std::cerr << "CabanaPF: MPI is not GPU-aware, so FFT reshapes are staged through host memory" << std::endl;
+    return binding;
+}
+
+/*Warn (once per process) if Kokkos is on a different GPU than this rank's share of the node would give it, e.g.
+every rank on GPU 0 because bind_device wasn't called and the launcher didn't bind them.  No MPI calls, so only
+checked when the launcher gives the node-local rank.*/
+inline void check_device_binding() {
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP)
+    static bool checked = false;
+    if (checked)
+        return;
+    checked = true;
+    const int local_rank = Impl::launcher_local_rank();
+    const int devices = Impl::visible_devices();
+    if (local_rank < 0 || devices < 2)
+        return;
+#if defined(KOKKOS_ENABLE_CUDA)
+    const int device = Kokkos::Cuda().cuda_device();
+#else
+    const int device = Kokkos::HIP().hip_device();
+#endif
+    if (device != local_rank % devices)
+        std::cerr << "CabanaPF: node-local rank " << local_rank << " is on GPU " << device << " of " << devices
+            << ", so GPUs may be oversubscribed; call bind_device before Kokkos::initialize" << std::endl;
+#endif
+}
+
+}
+
+#endif
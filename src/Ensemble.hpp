@@ -0,0 +1,74 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace CabanaPF {
+
+/*Splits the ranks of a parameter sweep into groups, each with its own sub-communicator and a share of the sweep
+points, so that groups run different points at the same time (each of them e.g. as one PFHub1aEnsemble).  Points
+are shared out by cost (e.g. timesteps times grid points), so that the groups finish at about the same time.*/
+class EnsembleGroups {
+    MPI_Comm group_comm;
+    int group;
+    int groups;
+
+public:
+    //Split comm into the given number of groups of consecutive ranks, as evenly as the number of ranks allows
+    EnsembleGroups(MPI_Comm comm, const int groups) : groups{groups} {
+        int rank, size;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+        if (groups < 1 || groups > size)
+            throw std::invalid_argument("Need between 1 and one group per rank");
+        group = static_cast<long>(rank) * groups / size;
+        MPI_Comm_split(comm, group, rank, &group_comm);
+    }
+
+    EnsembleGroups(const EnsembleGroups&) = delete;
+    EnsembleGroups& operator=(const EnsembleGroups&) = delete;
+
+    ~EnsembleGroups() {
+        MPI_Comm_free(&group_comm);
+    }
+
+    //The ranks of this rank's group
+    MPI_Comm comm() const {
+        return group_comm;
+    }
+
+    int index() const {
+        return group;
+    }
+
+    int count() const {
+        return groups;
+    }
+
+    /*The sweep points (indices into costs) this rank's group runs, in the order given.  The most expensive points
+    are handed out first, each to the group with the least work so far; every rank gets the same answer.*/
+    std::vector<int> assigned(const std::vector<double>& costs) const {
+        std::vector<int> by_cost(costs.size());
+        std::iota(by_cost.begin(), by_cost.end(), 0);
+        std::stable_sort(by_cost.begin(), by_cost.end(), [&](const int a, const int b) { return costs[a] > costs[b]; });
+        std::vector<double> load(groups, 0);
+        std::vector<int> mine;
+        for (const int point : by_cost) {
+            const int least = std::min_element(load.begin(), load.end()) - load.begin();
+            load[least] += costs[point];
+            if (least == group)
+                mine.push_back(point);
+        }
+        std::sort(mine.begin(), mine.end());
+        return mine;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,456 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <Cajita.hpp>
+#include <heffte.h>
+#include <DeviceBinding.hpp>
+#include <ScratchArena.hpp>
+#include <StepGraph.hpp>
+#include <cassert>
+#include <chrono>
+#include <complex>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <sstream>
+
+namespace CabanaPF {
+
+//heFFTe plan choices.  Anything left unset uses heFFTe's default for the backend.
+struct FFTOptions {
+    std::optional<bool> use_reorder;    //reorder data so each 1D FFT is contiguous
+    std::optional<bool> use_pencils;    //reshape through pencils (otherwise slabs, where possible)
+    std::optional<heffte::reshape_algorithm> algorithm;    //alltoallv, alltoall, p2p_plined or p2p
+    std::optional<bool> use_gpu_aware;  //hand MPI device pointers, or stage reshapes through host memory; detected if unset
+    bool autotune = false;  //time every combination of the above over a few transforms, and keep the fastest
+
+    template <class backend_type>
+    heffte::plan_options heffte_options() const {
+        auto options = heffte::default_options<backend_type>();
+        if (use_reorder)
+            options.use_reorder = *use_reorder;
+        if (use_pencils)
+            options.use_pencils = *use_pencils;
+        if (algorithm)
+            options.algorithm = *algorithm;
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP)
+        options.use_gpu_aware = use_gpu_aware.value_or(gpu_aware_mpi());
+#endif
+        return options;
+    }
+};
+
+/*Distributed FFT of the owned nodes of a layout, done directly with heFFTe.  The layout's dofs pick the transform:
+    -1 dof (a real field) uses real-to-complex FFTs, which only store the N/2+1 non-redundant points in x
+    -2 dofs (real & imag) uses complex-to-complex FFTs
+Fourier space values are kept in heFFTe's output layout, as a complex View with x as the fastest index.
+Scalar (double or float) is the precision of the transforms, the work buffer, and the spectra.  The work buffer and
+heFFTe's workspace come from a ScratchArena, which may be shared with other FFTs and temporaries: the workspace is
+only leased for the length of each transform, so every FFT on the arena uses the same one.*/
+template <std::size_t NumSpaceDim, class Scalar = double>
+class FFT {
+    using execution_space = Kokkos::DefaultExecutionSpace;
+    using memory_space = typename execution_space::memory_space;
+    using Mesh = Cajita::UniformMesh<double, NumSpaceDim>;
+    using cscalar = Kokkos::complex<Scalar>;
+    using backend_type = typename Cajita::Experimental::Impl::HeffteBackendTraits<
+        execution_space, Cajita::Experimental::Impl::FFTBackendDefault>::backend_type;
+public:
+    using Spectrum_type = std::conditional_t<3 == NumSpaceDim, Kokkos::View<cscalar***, Kokkos::LayoutLeft, memory_space>,
+        Kokkos::View<cscalar**, Kokkos::LayoutLeft, memory_space>>;
+    //Several spectra stored one after another (the last index picks the spectrum), so they can be transformed in one batch
+    using Batch_type = std::conditional_t<3 == NumSpaceDim, Kokkos::View<cscalar****, Kokkos::LayoutLeft, memory_space>,
+        Kokkos::View<cscalar***, Kokkos::LayoutLeft, memory_space>>;
+private:
+    int dofs;   //1: real-to-complex, 2: complex-to-complex
+    int max_batch;  //how many fields can be transformed together
+    Cajita::IndexSpace<NumSpaceDim> own_space;  //owned nodes, in local indices
+    std::array<int, NumSpaceDim> spectrum_low;  //global index of the first Fourier space point on this rank
+    std::array<int, NumSpaceDim> spectrum_size;
+    std::unique_ptr<heffte::fft3d<backend_type>> c2c;
+    std::unique_ptr<heffte::fft3d_r2c<backend_type>> r2c;
+    std::shared_ptr<ScratchArena> arena;
+    ScratchArena::Scratch<Kokkos::View<Scalar*, memory_space>> work_memory;
+    Kokkos::View<Scalar*, memory_space> work;       //real space values, packed with x fastest, one field after another
+    std::size_t workspace_size;     //heFFTe's scratch space for one field
+    std::array<int, 3> in_low, in_high, out_low, out_high;  //heFFTe's boxes, which are always 3D (inclusive bounds)
+    MPI_Comm comm;
+    heffte::plan_options current_options;
+
+    //(re)build the heFFTe plan
+    void plan(const heffte::plan_options& options) {
+        const heffte::box3d<> inbox(in_low, in_high);
+        const heffte::box3d<> outbox(out_low, out_high);
+        //on GPUs, heFFTe runs on Kokkos's stream rather than one of its own, so the FFTs stay in order with the
+        //kernels around them without fences, and a timestep can be captured as one graph (see StepGraph)
+        if (dofs == 1) {
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP)
+            r2c = std::make_unique<heffte::fft3d_r2c<backend_type>>(device_stream(), inbox, outbox, 0, comm, options);
+#else
+            r2c = std::make_unique<heffte::fft3d_r2c<backend_type>>(inbox, outbox, 0, comm, options);
+#endif
+            workspace_size = r2c->size_workspace();
+        } else {
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP)
+            c2c = std::make_unique<heffte::fft3d<backend_type>>(device_stream(), inbox, outbox, comm, options);
+#else
+            c2c = std::make_unique<heffte::fft3d<backend_type>>(inbox, outbox, comm, options);
+#endif
+            workspace_size = c2c->size_workspace();
+        }
+        current_options = options;
+    }
+
+    /*Try every combination of the options that weren't given, timing a few full-batch forward and backward
+    transforms with each.  The slowest rank's time is used, so every rank picks the same plan.*/
+    void autotune(const FFTOptions& given, const int trials = 3) {
+        std::vector<bool> reorders{true, false}, pencils{true, false};
+        std::vector<heffte::reshape_algorithm> algorithms{heffte::reshape_algorithm::alltoallv, heffte::reshape_algorithm::alltoall,
+            heffte::reshape_algorithm::p2p_plined, heffte::reshape_algorithm::p2p};
+        if (given.use_reorder)
+            reorders = {*given.use_reorder};
+        if (given.use_pencils)
+            pencils = {*given.use_pencils};
+        if (given.algorithm)
+            algorithms = {*given.algorithm};
+
+        Kokkos::deep_copy(work, 0.0);
+        auto spectra = create_spectra("autotune spectra", max_batch);
+        heffte::plan_options best = given.heffte_options<backend_type>();
+        double best_time = std::numeric_limits<double>::max();
+        for (const bool reorder : reorders) {
+            for (const bool pencil : pencils) {
+                for (const auto algorithm : algorithms) {
+                    auto options = given.heffte_options<backend_type>();
+                    options.use_reorder = reorder;
+                    options.use_pencils = pencil;
+                    options.algorithm = algorithm;
+                    plan(options);
+                    forward_packed(max_batch, spectra.data());  //warm up
+                    Kokkos::fence();
+                    const auto start = std::chrono::steady_clock::now();
+                    for (int t=0; t<trials; t++) {
+                        forward_packed(max_batch, spectra.data());
+                        reverse_packed(max_batch, spectra.data());
+                    }
+                    Kokkos::fence();
+                    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, comm);
+                    if (time < best_time) {
+                        best_time = time;
+                        best = options;
+                    }
+                }
+            }
+        }
+        plan(best);
+    }
+
+    static std::complex<Scalar>* heffte_ptr(cscalar* ptr) {
+        return reinterpret_cast<std::complex<Scalar>*>(ptr);
+    }
+
+    //heFFTe's workspace for a batch, held until the transform has been queued
+    ScratchArena::Scratch<Kokkos::View<cscalar*, memory_space>> lease_workspace(const int batch) {
+        return arena->view<Kokkos::View<cscalar*, memory_space>>(batch*workspace_size);
+    }
+
+public:
+    //arena: where the work buffer and workspace come from; by default, one of the FFT's own
+    FFT(const Cajita::ArrayLayout<Cajita::Node, Mesh>& layout, const int max_batch = 1, const FFTOptions& options = FFTOptions(),
+        std::shared_ptr<ScratchArena> arena = nullptr)
+        : dofs{layout.dofsPerEntity()}, max_batch{max_batch}, arena{arena ? arena : std::make_shared<ScratchArena>()},
+        workspace_size{0}, in_low{0, 0, 0}, in_high{0, 0, 0}, out_low{0, 0, 0}, out_high{0, 0, 0},
+        current_options{heffte::default_options<backend_type>()}
+    {
+        assert(dofs == 1 || dofs == 2);
+        const auto local_grid = layout.localGrid();
+        const auto& global_grid = local_grid->globalGrid();
+        own_space = local_grid->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local());
+
+        comm = global_grid.comm();
+        //x is the fastest index in heFFTe's boxes:
+        for (std::size_t d=0; d<NumSpaceDim; d++) {
+            in_low[d] = global_grid.globalOffset(d);
+            in_high[d] = in_low[d] + own_space.extent(d) - 1;
+            //the half spectrum has a different shape, so split it over the same rank grid:
+            const int global_points = global_grid.globalNumEntity(Cajita::Node(), d);
+            const int points = d==0 ? global_points/2 + 1 : global_points;
+            const int blocks = global_grid.dimNumBlock(d);
+            const int id = global_grid.dimBlockId(d);
+            out_low[d] = dofs == 1 ? id*points/blocks : in_low[d];
+            out_high[d] = dofs == 1 ? (id+1)*points/blocks - 1 : in_high[d];
+            spectrum_low[d] = out_low[d];
+            spectrum_size[d] = out_high[d] - out_low[d] + 1;
+        }
+        work_memory = this->arena->view<Kokkos::View<Scalar*, memory_space>>(max_batch*dofs*own_space.size());
+        work = work_memory.view;
+        if (options.autotune)
+            autotune(options);
+        else
+            plan(options.heffte_options<backend_type>());
+    }
+
+    //e.g. "reorder=1 pencils=0 algorithm=alltoallv", for reporting which plan is in use
+    std::string plan_description() const {
+        std::stringstream description;
+        description << "reorder=" << current_options.use_reorder << " pencils=" << current_options.use_pencils << " algorithm=";
+        switch (current_options.algorithm) {
+            case heffte::reshape_algorithm::alltoallv: description << "alltoallv"; break;
+            case heffte::reshape_algorithm::alltoall: description << "alltoall"; break;
+            case heffte::reshape_algorithm::p2p_plined: description << "p2p_plined"; break;
+            case heffte::reshape_algorithm::p2p: description << "p2p"; break;
+        }
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP)
+        description << " gpu_aware=" << current_options.use_gpu_aware;
+#endif
+        return description.str();
+    }
+
+    const heffte::plan_options& options() const {
+        return current_options;
+    }
+
+    bool is_real() const {
+        return dofs == 1;
+    }
+
+    const std::array<int, NumSpaceDim>& spectrum_offset() const {
+        return spectrum_low;
+    }
+
+    const std::array<int, NumSpaceDim>& spectrum_extent() const {
+        return spectrum_size;
+    }
+
+    //Allocate a View to hold this rank's part of the Fourier space values
+    Spectrum_type create_spectrum(const std::string& label) const {
+        if constexpr (NumSpaceDim == 3)
+            return Spectrum_type(label, spectrum_size[0], spectrum_size[1], spectrum_size[2]);
+        else
+            return Spectrum_type(label, spectrum_size[0], spectrum_size[1]);
+    }
+
+    Batch_type create_spectra(const std::string& label, const int count) const {
+        if constexpr (NumSpaceDim == 3)
+            return Batch_type(label, spectrum_size[0], spectrum_size[1], spectrum_size[2], count);
+        else
+            return Batch_type(label, spectrum_size[0], spectrum_size[1], count);
+    }
+
+    //Copy the owned values of a Cajita View into a slot of the work buffer (or back out of it)
+    template <class View_t>
+    void pack(const View_t& view, const int slot = 0) {
+        assert(slot < max_batch);
+        const auto buffer = Kokkos::subview(work, std::make_pair(slot*dofs*own_space.size(), (slot+1)*dofs*own_space.size()));
+        const int n = dofs;
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("fft pack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const int w = (i-x0) + nx*((j-y0) + ny*(k-z0));
+                for (int d=0; d<n; d++)
+                    buffer(n*w+d) = view(i, j, k, d);
+            });
+        } else {
+            Cajita::grid_parallel_for("fft pack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const int w = (i-x0) + nx*(j-y0);
+                for (int d=0; d<n; d++)
+                    buffer(n*w+d) = view(i, j, d);
+            });
+        }
+    }
+
+    template <class View_t>
+    void unpack(const View_t& view, const int slot = 0) {
+        assert(slot < max_batch);
+        const auto buffer = Kokkos::subview(work, std::make_pair(slot*dofs*own_space.size(), (slot+1)*dofs*own_space.size()));
+        const int n = dofs;
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("fft unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const int w = (i-x0) + nx*((j-y0) + ny*(k-z0));
+                for (int d=0; d<n; d++)
+                    view(i, j, k, d) = buffer(n*w+d);
+            });
+        } else {
+            Cajita::grid_parallel_for("fft unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const int w = (i-x0) + nx*(j-y0);
+                for (int d=0; d<n; d++)
+                    view(i, j, d) = buffer(n*w+d);
+            });
+        }
+    }
+
+    /*Fill Count slots of the work buffer, from first_slot on, from a functor instead of copying fields, so pointwise
+    work can be done in the same sweep as packing.  f(i, j, [k,] values) gets the owned (local) index and sets
+    values[v] for slot first_slot+v.  Only for real fields.  The kernel runs on space, e.g. to overlap it with a
+    transform of other slots (see PFVariables::fft_forward_pipelined).*/
+    template <int Count, class Functor, class ExecSpace = execution_space>
+    void pack_function(const Functor& f, const int first_slot = 0, const ExecSpace& space = ExecSpace()) {
+        assert(dofs == 1 && first_slot + Count <= max_batch);
+        const auto buffer = Kokkos::subview(work, std::make_pair(first_slot*own_space.size(), (first_slot+Count)*own_space.size()));
+        const long slot = own_space.size();
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("fft fused pack", space, own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const int w = (i-x0) + nx*((j-y0) + ny*(k-z0));
+                Kokkos::Array<double, Count> values;
+                f(i, j, k, values);
+                for (int v=0; v<Count; v++)
+                    buffer(v*slot + w) = values[v];
+            });
+        } else {
+            Cajita::grid_parallel_for("fft fused pack", space, own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const int w = (i-x0) + nx*(j-y0);
+                Kokkos::Array<double, Count> values;
+                f(i, j, values);
+                for (int v=0; v<Count; v++)
+                    buffer(v*slot + w) = values[v];
+            });
+        }
+    }
+
+    //The opposite of pack_function: f(i, j, [k,] values) is handed the real space values of the first Count slots
+    template <int Count, class Functor>
+    void unpack_function(const Functor& f) {
+        assert(dofs == 1 && Count <= max_batch);
+        const auto buffer = work;
+        const long slot = own_space.size();
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("fft fused unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const int w = (i-x0) + nx*((j-y0) + ny*(k-z0));
+                Kokkos::Array<double, Count> values;
+                for (int v=0; v<Count; v++)
+                    values[v] = buffer(v*slot + w);
+                f(i, j, k, values);
+            });
+        } else {
+            Cajita::grid_parallel_for("fft fused unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const int w = (i-x0) + nx*(j-y0);
+                Kokkos::Array<double, Count> values;
+                for (int v=0; v<Count; v++)
+                    values[v] = buffer(v*slot + w);
+                f(i, j, values);
+            });
+        }
+    }
+
+    /*Like pack_function, for a number of slots only known at run time: f(i, j, [k,] slot) returns the value for that
+    slot.  One kernel fills them all, e.g. for an ensemble of fields stored as the components of one array.*/
+    template <class Functor>
+    void pack_slots(const int count, const Functor& f) {
+        assert(dofs == 1 && count <= max_batch);
+        const auto buffer = work;
+        const long slot = own_space.size();
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("fft slot pack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const int w = (i-x0) + nx*((j-y0) + ny*(k-z0));
+                for (int v=0; v<count; v++)
+                    buffer(v*slot + w) = f(i, j, k, v);
+            });
+        } else {
+            Cajita::grid_parallel_for("fft slot pack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const int w = (i-x0) + nx*(j-y0);
+                for (int v=0; v<count; v++)
+                    buffer(v*slot + w) = f(i, j, v);
+            });
+        }
+    }
+
+    //The opposite of pack_slots: f(i, j, [k,] slot, value) is handed the real space value of each of the first count slots
+    template <class Functor>
+    void unpack_slots(const int count, const Functor& f) {
+        assert(dofs == 1 && count <= max_batch);
+        const auto buffer = work;
+        const long slot = own_space.size();
+        const int nx = own_space.extent(0), ny = own_space.extent(1);
+        const int x0 = own_space.min(0), y0 = own_space.min(1);
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = own_space.min(2);
+            Cajita::grid_parallel_for("fft slot unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const int w = (i-x0) + nx*((j-y0) + ny*(k-z0));
+                for (int v=0; v<count; v++)
+                    f(i, j, k, v, buffer(v*slot + w));
+            });
+        } else {
+            Cajita::grid_parallel_for("fft slot unpack", execution_space(), own_space, KOKKOS_LAMBDA(const int i, const int j) {
+                const int w = (i-x0) + nx*(j-y0);
+                for (int v=0; v<count; v++)
+                    f(i, j, v, buffer(v*slot + w));
+            });
+        }
+    }
+
+    /*Transform batch slots of the work buffer, from first_slot on, into spectra, which must be stored one after
+    another starting at output.  A batch shares one set of heFFTe reshapes, so it only pays for the communication once.
+    The transform only reads its own slots, so others can be packed meanwhile.*/
+    void forward_packed(const int batch, cscalar* output, const int first_slot = 0) {
+        assert(first_slot + batch <= max_batch);
+        Kokkos::Profiling::pushRegion("CabanaPF::heffte_forward");
+        const auto workspace = lease_workspace(batch);
+        const auto scratch = heffte_ptr(workspace.view.data());
+        Scalar* const first = work.data() + first_slot*dofs*own_space.size();
+        if (dofs == 1) {
+            if (batch == 1)
+                r2c->forward(first, heffte_ptr(output), scratch, heffte::scale::none);
+            else
+                r2c->forward(batch, first, heffte_ptr(output), scratch, heffte::scale::none);
+        } else {
+            const auto input = reinterpret_cast<std::complex<Scalar>*>(first);
+            if (batch == 1)
+                c2c->forward(input, heffte_ptr(output), scratch, heffte::scale::none);
+            else
+                c2c->forward(batch, input, heffte_ptr(output), scratch, heffte::scale::none);
+        }
+        Kokkos::Profiling::popRegion();
+    }
+
+    //The inverse of forward_packed: the results are left in the work buffer, to be unpacked
+    void reverse_packed(const int batch, cscalar* input) {
+        assert(batch <= max_batch);
+        Kokkos::Profiling::pushRegion("CabanaPF::heffte_backward");
+        const auto workspace = lease_workspace(batch);
+        const auto scratch = heffte_ptr(workspace.view.data());
+        if (dofs == 1) {
+            if (batch == 1)
+                r2c->backward(heffte_ptr(input), work.data(), scratch, heffte::scale::full);
+            else
+                r2c->backward(batch, heffte_ptr(input), work.data(), scratch, heffte::scale::full);
+        } else {
+            const auto output = reinterpret_cast<std::complex<Scalar>*>(work.data());
+            if (batch == 1)
+                c2c->backward(heffte_ptr(input), output, scratch, heffte::scale::full);
+            else
+                c2c->backward(batch, heffte_ptr(input), output, scratch, heffte::scale::full);
+        }
+        Kokkos::Profiling::popRegion();
+    }
+
+    template <class Array_t>
+    void forward(const Array_t& array, const Spectrum_type& spectrum) {
+        pack(array.view());
+        forward_packed(1, spectrum.data());
+    }
+
+    template <class Array_t>
+    void reverse(const Spectrum_type& spectrum, const Array_t& array) {
+        reverse_packed(1, spectrum.data());
+        unpack(array.view());
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef FINITEDIFFERENCE_H
+#define FINITEDIFFERENCE_H
+
+#include <Cajita.hpp>
+#include <CahnHilliard.hpp>
+#include <PFVariables.hpp>
+#include <Runner.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace CabanaPF {
+
+/*Cahn-Hilliard with second order central differences and explicit Euler timesteps, as the stencil alternative to
+CahnHilliard: same parameters, interface, and initial conditions (see PeriodicCahnHilliard), but no FFTs, so no
+all-to-all communication, only a halo exchange with neighboring ranks.  Each timestep is two stages,
+    mu = df_dc(c) - KAPPA*lap(c),  then  c = c + dt*M*lap(mu),
+each needing a one node halo of its input.  With overlap on (the default), each stage updates the nodes that don't
+need the halo on a second execution space instance while the halo is exchanged, then the boundary nodes.
+Being explicit, the timestep has to be below max_stable_dt(), which goes as dx^4: this pays off when many ranks make
+the FFT's communication the bottleneck, or for short runs, not for reaching END_TIME on fine grids.*/
+template <std::size_t NumSpaceDim, class Scalar = double>
+class FiniteDifferenceCahnHilliard : public CabanaPFRunner<NumSpaceDim> {
+protected:
+    using exec_space = typename CabanaPFRunner<NumSpaceDim>::exec_space;
+    using memory_space = typename exec_space::memory_space;
+
+    const CahnHilliardParameters parameters;
+    const double cell_size;
+    const double dt;
+
+    std::shared_ptr<Cajita::Halo<memory_space>> halo;
+    exec_space interior_space;      //for the nodes that don't need the halo, while it is exchanged
+    Cajita::IndexSpace<NumSpaceDim> owned;
+    Cajita::IndexSpace<NumSpaceDim> interior;   //owned nodes at least one node away from the rank's boundary
+    std::vector<Cajita::IndexSpace<NumSpaceDim>> boundary;  //the rest of the owned nodes, as 2*NumSpaceDim slabs
+    bool overlap;
+
+    //A stage's kernel labels, built once rather than every timestep
+    struct StageLabels {
+        std::string all, interior, boundary;
+        explicit StageLabels(const std::string& name) : all{name}, interior{name + " interior"}, boundary{name + " boundary"} {}
+    };
+    const StageLabels chemical_potential_labels{"chemical potential"};
+    const StageLabels concentration_labels{"concentration"};
+
+    //The 5 or 7 point Laplacian of v at a node
+    template <class View_t>
+    static KOKKOS_INLINE_FUNCTION double laplacian(const View_t& v, const double inv_h2, const int i, const int j) {
+        return (v(i+1, j, 0) + v(i-1, j, 0) + v(i, j+1, 0) + v(i, j-1, 0) - 4.0*v(i, j, 0)) * inv_h2;
+    }
+
+    template <class View_t>
+    static KOKKOS_INLINE_FUNCTION double laplacian(const View_t& v, const double inv_h2, const int i, const int j, const int k) {
+        return (v(i+1, j, k, 0) + v(i-1, j, k, 0) + v(i, j+1, k, 0) + v(i, j-1, k, 0) + v(i, j, k+1, 0) + v(i, j, k-1, 0)
+            - 6.0*v(i, j, k, 0)) * inv_h2;
+    }
+
+    //Split the owned nodes into the interior and the boundary slabs; the slabs are disjoint, so no node is updated twice
+    void build_index_spaces() {
+        owned = this->local_grid->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local());
+        std::array<long, NumSpaceDim> min, max;
+        for (std::size_t d=0; d<NumSpaceDim; d++) {
+            min[d] = owned.min(d) + 1;
+            max[d] = owned.max(d) - 1;
+        }
+        interior = Cajita::IndexSpace<NumSpaceDim>(min, max);
+        //slab d is one node thick in dimension d, the interior's range in the dimensions before, and all owned after
+        for (std::size_t d=0; d<NumSpaceDim; d++) {
+            for (const long side : {owned.min(d), owned.max(d) - 1}) {
+                std::array<long, NumSpaceDim> slab_min, slab_max;
+                for (std::size_t e=0; e<NumSpaceDim; e++) {
+                    slab_min[e] = e < d ? min[e] : owned.min(e);
+                    slab_max[e] = e < d ? max[e] : owned.max(e);
+                }
+                slab_min[d] = side;
+                slab_max[d] = side + 1;
+                boundary.push_back(Cajita::IndexSpace<NumSpaceDim>(slab_min, slab_max));
+            }
+        }
+    }
+
+    //Whether each rank's block is thick enough (3 nodes) for its two boundary slabs not to overlap
+    bool can_overlap() const {
+        for (std::size_t d=0; d<NumSpaceDim; d++)
+            if (owned.extent(d) < 3)
+                return false;
+        return true;
+    }
+
+    //Exchange source's halo and apply kernel to every owned node, with the interior going on during the exchange
+    template <class Array_t, class Kernel>
+    void stencil_stage(const StageLabels& labels, Array_t& source, const Kernel& kernel) {
+        if (!overlap || !can_overlap()) {
+            halo->gather(exec_space(), source);
+            this->index_parallel_for(labels.all.c_str(), exec_space(), owned, kernel);
+            return;
+        }
+        exec_space().fence();       //the interior reads what the last stage wrote on the default instance
+        this->index_parallel_for(labels.interior.c_str(), interior_space, interior, kernel);
+        halo->gather(exec_space(), source);
+        for (const auto& slab : boundary)
+            this->index_parallel_for(labels.boundary.c_str(), exec_space(), slab, kernel);
+        interior_space.fence();
+    }
+
+public:
+    PFVariables<NumSpaceDim, 2, Scalar, 0> vars;    //c and mu, with halos and no spectra
+
+    FiniteDifferenceCahnHilliard(int grid_points, int timesteps, const CahnHilliardParameters& parameters = CahnHilliardParameters(),
+            MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<NumSpaceDim>& decomposition = Decomposition<NumSpaceDim>())
+        : CabanaPFRunner<NumSpaceDim>(grid_points, timesteps, parameters.size, 1, comm, decomposition, 1),
+        parameters{parameters}, cell_size{parameters.size/grid_points}, dt{parameters.end_time/timesteps},
+        interior_space{Kokkos::Experimental::partition_space(exec_space(), 1)[0]}, overlap{true},
+        vars{this->layout, {"c", "mu"}, FFTOptions(), this->arena}
+    {
+        if (dt > max_stable_dt(grid_points, parameters))
+            throw std::invalid_argument("The finite difference timestep is above its stability limit; use more timesteps");
+        halo = Cajita::createHalo(Cajita::NodeHaloPattern<NumSpaceDim>(), 1, *vars.arrays[0]);
+        build_index_spaces();
+    }
+
+    //Problem-specific initial conditions
+    virtual void initial_conditions()=0;
+    //Prefix for this run's output files
+    virtual std::string run_name() const=0;
+
+    /*The largest stable explicit timestep, from the biharmonic term: the discrete Laplacian's eigenvalues go down to
+    -4*NumSpaceDim/dx^2, and Euler needs dt*M*KAPPA*lambda^2 <= 2 for all of them.*/
+    static double max_stable_dt(const int grid_points, const CahnHilliardParameters& parameters = CahnHilliardParameters()) {
+        const double dx = parameters.size / grid_points;
+        return dx*dx*dx*dx / (8.0*NumSpaceDim*NumSpaceDim*parameters.mobility*parameters.kappa);
+    }
+
+    //Whether to update the interior while the halo is exchanged (on by default); either way gives the same results
+    void set_overlap(const bool value) {
+        overlap = value;
+    }
+
+    double timestep_size() const {
+        return dt;
+    }
+
+    double simulation_time() const override {
+        return this->timesteps_done * dt;
+    }
+
+    //The owned nodes of c, without the halo (copied to a contiguous View first, since the subview is strided)
+    auto get_cpu_view() {
+        if constexpr (NumSpaceDim == 3) {
+            const auto c = Kokkos::subview(vars[0], owned.range(0), owned.range(1), owned.range(2), Kokkos::ALL());
+            Kokkos::View<Scalar****, memory_space> contiguous("c", c.extent(0), c.extent(1), c.extent(2), 1);
+            Kokkos::deep_copy(contiguous, c);
+            return Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), contiguous);
+        } else {
+            const auto c = Kokkos::subview(vars[0], owned.range(0), owned.range(1), Kokkos::ALL());
+            Kokkos::View<Scalar***, memory_space> contiguous("c", c.extent(0), c.extent(1), 1);
+            Kokkos::deep_copy(contiguous, c);
+            return Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), contiguous);
+        }
+    }
+
+    //Write c, mu, and the step count so far to a checkpoint named after run_name, for restart()
+    void checkpoint(const std::string& run_name, const bool async = false) {
+        this->timers.start("io");
+        vars.checkpoint(run_name, {this->timesteps_done, dt, simulation_time()}, async);
+        this->timers.stop("io");
+    }
+
+    void wait_for_output() {
+        vars.wait_for_output();
+    }
+
+    //Continue from the checkpoint written after from_timestep timesteps, instead of from the initial conditions
+    void restart(const std::string& run_name, const int from_timestep) {
+        this->timers.start("io");
+        const auto info = vars.restart(run_name, from_timestep);
+        this->timers.stop("io");
+        if (info.dt != dt)
+            throw std::runtime_error("Checkpoint " + run_name + " was written with a different timestep size");
+        this->timesteps_done = info.timesteps_done;
+        this->have_initialized = true;
+    }
+
+    void output() {
+        this->timers.start("io");
+        vars.save(0, run_name());
+        this->timers.stop("io");
+    }
+
+    //Called by the output schedule: writes c, with the timestep in the file name
+    void snapshot() override {
+        vars.snapshot(0, run_name(), this->timesteps_done, simulation_time());
+    }
+
+    void initialize() override {
+        initial_conditions();
+    }
+
+    //mu from c
+    void step() override {
+        const auto c = vars[0];
+        const auto mu = vars[1];
+        const CahnHilliardParameters p = parameters;
+        const double inv_h2 = 1.0 / (cell_size*cell_size);
+        this->timers.start("chemical_potential");
+        if constexpr (NumSpaceDim == 3) {
+            stencil_stage(chemical_potential_labels, *vars.arrays[0], KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                mu(i, j, k, 0) = p.df_dc(c(i, j, k, 0)) - p.kappa*laplacian(c, inv_h2, i, j, k);
+            });
+        } else {
+            stencil_stage(chemical_potential_labels, *vars.arrays[0], KOKKOS_LAMBDA(const int i, const int j) {
+                mu(i, j, 0) = p.df_dc(c(i, j, 0)) - p.kappa*laplacian(c, inv_h2, i, j);
+            });
+        }
+        this->timers.stop("chemical_potential");
+    }
+
+    //c from mu
+    void post_step() override {
+        const auto c = vars[0];
+        const auto mu = vars[1];
+        const double factor = dt * parameters.mobility / (cell_size*cell_size);
+        this->timers.start("concentration");
+        if constexpr (NumSpaceDim == 3) {
+            stencil_stage(concentration_labels, *vars.arrays[1], KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                c(i, j, k, 0) += factor*laplacian(mu, 1.0, i, j, k);
+            });
+        } else {
+            stencil_stage(concentration_labels, *vars.arrays[1], KOKKOS_LAMBDA(const int i, const int j) {
+                c(i, j, 0) += factor*laplacian(mu, 1.0, i, j);
+            });
+        }
+        this->timers.stop("concentration");
+    }
+};
+
+}
+
+#endif
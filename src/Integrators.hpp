@@ -0,0 +1,258 @@
+#ifndef INTEGRATORS_H
+#define INTEGRATORS_H
+
+#include <Cajita.hpp>
+#include <FFT.hpp>
+#include <SpectralOperators.hpp>
+
+#include <cmath>
+#include <functional>
+#include <string>
+
+namespace CabanaPF {
+
+/*Time integrators for semi-linear problems in Fourier space, u_hat' = L u_hat + N(u), where L is diagonal (e.g. -M*KAPPA*k^4
+for Cahn-Hilliard) and N needs real space (e.g. -M*k^2 times the transform of df_dc).  The problem supplies L, N at the start of
+the step (which it can get from the FFTs it does anyway), and a function evaluating N at other points.  Each evaluation of that
+function costs the problem an inverse and a forward FFT, so higher order schemes trade FFTs per step for much larger steps.
+The spectra are in the problem's precision (Scalar), while the coefficients, which are computed once, are kept in double.*/
+template <std::size_t NumSpaceDim, class Scalar = double>
+class SpectralIntegrator {
+protected:
+    using execution_space = Kokkos::DefaultExecutionSpace;
+    using memory_space = typename execution_space::memory_space;
+    using Flat_spectrum = Kokkos::View<Kokkos::complex<Scalar>*, memory_space, Kokkos::MemoryUnmanaged>;
+    using Flat_operator = Kokkos::View<double*, memory_space, Kokkos::MemoryUnmanaged>;
+public:
+    using Spectrum_type = typename FFT<NumSpaceDim, Scalar>::Spectrum_type;
+    using Operator_type = typename SpectralOperators<NumSpaceDim>::Operator_type;
+    //nonlinear(u_hat, n_hat) sets n_hat to N(u); it may use the problem's own spectra and fields, but not change u_hat
+    using Nonlinear = std::function<void(const Spectrum_type& u_hat, const Spectrum_type& n_hat)>;
+
+    virtual ~SpectralIntegrator() = default;
+    virtual std::string name() const = 0;
+    //evaluations of nonlinear per step (beyond the one at the start, which the problem provides)
+    virtual int stages() const = 0;
+    //Advance u_hat by dt in place, given n_hat = N(u) at the start of the step
+    virtual void step(const double dt, const Operator_type& linear, const Spectrum_type& u_hat, const Spectrum_type& n_hat,
+        const Nonlinear& nonlinear) = 0;
+
+protected:
+    //the views are contiguous, so the pointwise kernels can ignore the dimension
+    static Flat_spectrum flat(const Spectrum_type& view) {
+        return Flat_spectrum(view.data(), view.span());
+    }
+
+    static Flat_operator flat(const Operator_type& view) {
+        return Flat_operator(view.data(), view.span());
+    }
+
+    static Spectrum_type like(const std::string& label, const Spectrum_type& view) {
+        return Spectrum_type(Kokkos::view_alloc(label), view.layout());
+    }
+
+    static Operator_type like(const std::string& label, const Operator_type& view) {
+        return Operator_type(Kokkos::view_alloc(label), view.layout());
+    }
+
+    //Whether a and b have the same extents, e.g. so stage spectra sized for one problem aren't used for another's
+    template <class View_t>
+    static bool same_extents(const View_t& a, const View_t& b) {
+        for (unsigned r=0; r<View_t::rank; r++)
+            if (a.extent(r) != b.extent(r))
+                return false;
+        return true;
+    }
+
+    /*phi_1(z) = (e^z-1)/z, phi_2(z) = (e^z-1-z)/z^2, phi_3(z) = (e^z-1-z-z^2/2)/z^3, which lose all accuracy to
+    cancellation near z=0 if evaluated directly, so small z uses their Taylor series instead.*/
+    static KOKKOS_INLINE_FUNCTION void phi(const double z, double& phi1, double& phi2, double& phi3) {
+        if (Kokkos::fabs(z) < 1) {
+            //phi_k(z) = sum over n of z^n/(n+k)!
+            double term = 1;    //z^n/n!
+            phi1 = phi2 = phi3 = 0;
+            double factorial1 = 1, factorial2 = 2, factorial3 = 6;  //(n+1)!/n!, (n+2)!/n!, (n+3)!/n!
+            for (int n=0; n<20; n++) {
+                phi1 += term / factorial1;
+                phi2 += term / factorial2;
+                phi3 += term / factorial3;
+                term *= z / (n+1);
+                factorial1 *= (n+2.) / (n+1);
+                factorial2 *= (n+3.) / (n+1);
+                factorial3 *= (n+4.) / (n+1);
+            }
+        } else {
+            const double e = Kokkos::exp(z);
+            phi1 = (e - 1) / z;
+            phi2 = (e - 1 - z) / (z*z);
+            phi3 = (e - 1 - z - z*z/2) / (z*z*z);
+        }
+    }
+};
+
+/*Second order exponential time differencing (ETDRK2, Cox & Matthews 2002):
+    a = e^(L dt) u + dt phi_1(L dt) N(u)
+    u_new = a + dt phi_2(L dt) (N(a) - N(u))*/
+template <std::size_t NumSpaceDim, class Scalar = double>
+class ETDRK2 : public SpectralIntegrator<NumSpaceDim, Scalar> {
+    using Base = SpectralIntegrator<NumSpaceDim, Scalar>;
+    using typename Base::execution_space;
+    using typename Base::Spectrum_type;
+    using typename Base::Operator_type;
+    using typename Base::Nonlinear;
+
+    //the coefficients are for coefficient_dt and coefficient_linear, so an integrator can be shared between problems
+    double coefficient_dt = 0;
+    Operator_type coefficient_linear;
+    Operator_type exponential, coefficient1, coefficient2;
+    Spectrum_type a_hat, n_a_hat;
+
+    void build(const double dt, const Operator_type& linear) {
+        if (!Base::same_extents(exponential, linear)) {
+            exponential = Base::like("etdrk2 e^(L dt)", linear);
+            coefficient1 = Base::like("etdrk2 dt phi_1", linear);
+            coefficient2 = Base::like("etdrk2 dt phi_2", linear);
+        }
+        const auto L = Base::flat(linear);
+        const auto e = Base::flat(exponential);
+        const auto c1 = Base::flat(coefficient1);
+        const auto c2 = Base::flat(coefficient2);
+        Kokkos::parallel_for("etdrk2 coefficients", Kokkos::RangePolicy<execution_space>(0, L.size()), KOKKOS_LAMBDA(const long w) {
+            double phi1, phi2, phi3;
+            Base::phi(L(w)*dt, phi1, phi2, phi3);
+            e(w) = Kokkos::exp(L(w)*dt);
+            c1(w) = dt*phi1;
+            c2(w) = dt*phi2;
+        });
+        coefficient_dt = dt;
+        coefficient_linear = linear;
+    }
+
+public:
+    std::string name() const override {
+        return "ETDRK2";
+    }
+
+    int stages() const override {
+        return 1;
+    }
+
+    void step(const double dt, const Operator_type& linear, const Spectrum_type& u_hat, const Spectrum_type& n_hat,
+        const Nonlinear& nonlinear) override
+    {
+        if (dt != coefficient_dt || linear.data() != coefficient_linear.data())
+            build(dt, linear);
+        if (!Base::same_extents(a_hat, u_hat)) {
+            a_hat = Base::like("etdrk2 a", u_hat);
+            n_a_hat = Base::like("etdrk2 N(a)", u_hat);
+        }
+        const auto u = Base::flat(u_hat), n_u = Base::flat(n_hat), a = Base::flat(a_hat), n_a = Base::flat(n_a_hat);
+        const auto e = Base::flat(exponential), c1 = Base::flat(coefficient1), c2 = Base::flat(coefficient2);
+        Kokkos::parallel_for("etdrk2 a", Kokkos::RangePolicy<execution_space>(0, u.size()), KOKKOS_LAMBDA(const long w) {
+            a(w) = e(w)*u(w) + c1(w)*n_u(w);
+        });
+        nonlinear(a_hat, n_a_hat);
+        Kokkos::parallel_for("etdrk2 update", Kokkos::RangePolicy<execution_space>(0, u.size()), KOKKOS_LAMBDA(const long w) {
+            u(w) = a(w) + c2(w)*(n_a(w) - n_u(w));
+        });
+    }
+};
+
+/*Fourth order exponential time differencing (ETDRK4, Cox & Matthews 2002, with the coefficients written in terms of
+phi functions as in Kassam & Trefethen 2005), with h = dt and E = e^(L h), E2 = e^(L h/2), Q = h/2 phi_1(L h/2):
+    a = E2 u + Q N(u)
+    b = E2 u + Q N(a)
+    c = E2 a + Q (2N(b) - N(u))
+    u_new = E u + f1 N(u) + 2 f2 (N(a) + N(b)) + f3 N(c)
+where f1 = h (phi_1 - 3phi_2 + 4phi_3), f2 = h (phi_2 - 2phi_3), and f3 = h (4phi_3 - phi_2), all at L h.*/
+template <std::size_t NumSpaceDim, class Scalar = double>
+class ETDRK4 : public SpectralIntegrator<NumSpaceDim, Scalar> {
+    using Base = SpectralIntegrator<NumSpaceDim, Scalar>;
+    using typename Base::execution_space;
+    using typename Base::Spectrum_type;
+    using typename Base::Operator_type;
+    using typename Base::Nonlinear;
+
+    //the coefficients are for coefficient_dt and coefficient_linear, as in ETDRK2
+    double coefficient_dt = 0;
+    Operator_type coefficient_linear;
+    Operator_type E, E2, Q, f1, f2, f3;
+    Spectrum_type a_hat, b_hat, c_hat, n_a_hat, n_b_hat, n_c_hat;
+
+    void build(const double dt, const Operator_type& linear) {
+        if (!Base::same_extents(E, linear)) {
+            E = Base::like("etdrk4 E", linear);
+            E2 = Base::like("etdrk4 E2", linear);
+            Q = Base::like("etdrk4 Q", linear);
+            f1 = Base::like("etdrk4 f1", linear);
+            f2 = Base::like("etdrk4 f2", linear);
+            f3 = Base::like("etdrk4 f3", linear);
+        }
+        const auto L = Base::flat(linear);
+        const auto e = Base::flat(E), e2 = Base::flat(E2), q = Base::flat(Q);
+        const auto g1 = Base::flat(f1), g2 = Base::flat(f2), g3 = Base::flat(f3);
+        Kokkos::parallel_for("etdrk4 coefficients", Kokkos::RangePolicy<execution_space>(0, L.size()), KOKKOS_LAMBDA(const long w) {
+            double phi1, phi2, phi3;
+            Base::phi(L(w)*dt/2, phi1, phi2, phi3);
+            e2(w) = Kokkos::exp(L(w)*dt/2);
+            q(w) = dt/2*phi1;
+            Base::phi(L(w)*dt, phi1, phi2, phi3);
+            e(w) = Kokkos::exp(L(w)*dt);
+            g1(w) = dt*(phi1 - 3*phi2 + 4*phi3);
+            g2(w) = dt*(phi2 - 2*phi3);
+            g3(w) = dt*(4*phi3 - phi2);
+        });
+        coefficient_dt = dt;
+        coefficient_linear = linear;
+    }
+
+public:
+    std::string name() const override {
+        return "ETDRK4";
+    }
+
+    int stages() const override {
+        return 3;
+    }
+
+    void step(const double dt, const Operator_type& linear, const Spectrum_type& u_hat, const Spectrum_type& n_hat,
+        const Nonlinear& nonlinear) override
+    {
+        if (dt != coefficient_dt || linear.data() != coefficient_linear.data())
+            build(dt, linear);
+        if (!Base::same_extents(a_hat, u_hat)) {
+            a_hat = Base::like("etdrk4 a", u_hat);
+            b_hat = Base::like("etdrk4 b", u_hat);
+            c_hat = Base::like("etdrk4 c", u_hat);
+            n_a_hat = Base::like("etdrk4 N(a)", u_hat);
+            n_b_hat = Base::like("etdrk4 N(b)", u_hat);
+            n_c_hat = Base::like("etdrk4 N(c)", u_hat);
+        }
+        const auto u = Base::flat(u_hat), n_u = Base::flat(n_hat);
+        const auto a = Base::flat(a_hat), b = Base::flat(b_hat), c = Base::flat(c_hat);
+        const auto n_a = Base::flat(n_a_hat), n_b = Base::flat(n_b_hat), n_c = Base::flat(n_c_hat);
+        const auto e = Base::flat(E), e2 = Base::flat(E2), q = Base::flat(Q);
+        const auto g1 = Base::flat(f1), g2 = Base::flat(f2), g3 = Base::flat(f3);
+        const auto points = Kokkos::RangePolicy<execution_space>(0, u.size());
+
+        Kokkos::parallel_for("etdrk4 a", points, KOKKOS_LAMBDA(const long w) {
+            a(w) = e2(w)*u(w) + q(w)*n_u(w);
+        });
+        nonlinear(a_hat, n_a_hat);
+        Kokkos::parallel_for("etdrk4 b", points, KOKKOS_LAMBDA(const long w) {
+            b(w) = e2(w)*u(w) + q(w)*n_a(w);
+        });
+        nonlinear(b_hat, n_b_hat);
+        Kokkos::parallel_for("etdrk4 c", points, KOKKOS_LAMBDA(const long w) {
+            c(w) = e2(w)*a(w) + q(w)*(2.0*n_b(w) - n_u(w));
+        });
+        nonlinear(c_hat, n_c_hat);
+        Kokkos::parallel_for("etdrk4 update", points, KOKKOS_LAMBDA(const long w) {
+            u(w) = e(w)*u(w) + g1(w)*n_u(w) + 2.0*g2(w)*(n_a(w) + n_b(w)) + g3(w)*n_c(w);
+        });
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef KERNELTUNING_H
+#define KERNELTUNING_H
+
+#include <Kokkos_Core.hpp>
+
+#include <array>
+
+namespace CabanaPF {
+
+/*How pointwise kernels over a grid are launched (see tuned_parallel_for).  The defaults are an MDRange with Kokkos's
+tiles.  Either way the index that is contiguous in memory is the one iterated fastest, so that CPU builds vectorize
+it: the last for Cajita's arrays (their dofs are innermost already), and the first (x) for heFFTe's spectra.*/
+template <std::size_t NumSpaceDim>
+struct KernelTuning {
+    std::array<int, NumSpaceDim> tile{};    //MDRange tile sizes, per index; zeros leave them to Kokkos
+    bool team = false;      //use a TeamPolicy instead: a team per row of the contiguous index, over its threads and vector lanes
+    int team_size = 0;      //for team, 0 for Kokkos::AUTO
+    int vector_length = 0;  //for team, 0 for Kokkos::AUTO
+};
+
+//Which index of a kernel's Views is contiguous in memory
+enum class Contiguous {
+    first,  //LayoutLeft, like the spectra
+    last    //LayoutRight, like Cajita's arrays
+};
+
+//The MDRange rank for kernels over spectra (e.g. reductions, which don't go through tuned_parallel_for), x fastest
+template <unsigned Rank>
+using SpectralRank = Kokkos::Rank<Rank, Kokkos::Iterate::Left, Kokkos::Iterate::Left>;
+
+namespace Impl {
+
+template <std::size_t NumSpaceDim, class Functor>
+KOKKOS_FORCEINLINE_FUNCTION void apply(const Functor& functor, const long (&index)[NumSpaceDim]) {
+    if constexpr (NumSpaceDim == 3)
+        functor(index[0], index[1], index[2]);
+    else
+        functor(index[0], index[1]);
+}
+
+template <Contiguous Order, class ExecSpace, std::size_t NumSpaceDim, class Functor>
+void team_parallel_for(const char* label, const ExecSpace& space, const std::array<long, NumSpaceDim>& min,
+    const std::array<long, NumSpaceDim>& max, const KernelTuning<NumSpaceDim>& tuning, const Functor& functor)
+{
+    using Policy = Kokkos::TeamPolicy<ExecSpace>;
+    //the contiguous index goes over each team's threads and lanes, and the league over the rest
+    constexpr std::size_t inner = Order == Contiguous::first ? 0 : NumSpaceDim-1;
+    constexpr std::size_t outer = Order == Contiguous::first ? NumSpaceDim-1 : 0;
+    long league = 1;
+    for (std::size_t d=0; d<NumSpaceDim; d++)
+        if (d != inner)
+            league *= max[d] - min[d];
+    Policy policy = tuning.team_size > 0
+        ? (tuning.vector_length > 0 ? Policy(space, league, tuning.team_size, tuning.vector_length) : Policy(space, league, tuning.team_size, Kokkos::AUTO))
+        : (tuning.vector_length > 0 ? Policy(space, league, Kokkos::AUTO, tuning.vector_length) : Policy(space, league, Kokkos::AUTO, Kokkos::AUTO));
+    const long inner_min = min[inner], inner_extent = max[inner] - min[inner];
+    const long outer_min = min[outer], outer_extent = max[outer] - min[outer];
+    constexpr std::size_t middle = 1;   //in 3D, the index that is neither
+    const long middle_min = min[middle];
+    Kokkos::parallel_for(label, policy, KOKKOS_LAMBDA(const typename Policy::member_type& member) {
+        const long row = member.league_rank();
+        long index[NumSpaceDim];
+        if constexpr (NumSpaceDim == 3) {
+            index[outer] = outer_min + row % outer_extent;
+            index[middle] = middle_min + row / outer_extent;
+        } else {
+            index[outer] = outer_min + row;
+        }
+        Kokkos::parallel_for(Kokkos::TeamVectorRange(member, inner_extent), [&](const long i) {
+            long point[NumSpaceDim];
+            for (std::size_t d=0; d<NumSpaceDim; d++)
+                point[d] = index[d];
+            point[inner] = inner_min + i;
+            apply<NumSpaceDim>(functor, point);
+        });
+    });
+}
+
+}
+
+/*functor(i, j[, k]) at every point with min <= index < max, launched on space as tuning says, with the Order index
+iterated fastest.  Results don't depend on the tuning, only the order the points are visited in.*/
+template <Contiguous Order, class ExecSpace, std::size_t NumSpaceDim, class Functor>
+void tuned_parallel_for(const char* label, const ExecSpace& space, const std::array<long, NumSpaceDim>& min,
+    const std::array<long, NumSpaceDim>& max, const KernelTuning<NumSpaceDim>& tuning, const Functor& functor)
+{
+    if (tuning.team) {
+        Impl::team_parallel_for<Order>(label, space, min, max, tuning, functor);
+        return;
+    }
+    constexpr auto iterate = Order == Contiguous::first ? Kokkos::Iterate::Left : Kokkos::Iterate::Right;
+    using Policy = Kokkos::MDRangePolicy<ExecSpace, Kokkos::Rank<NumSpaceDim, iterate, iterate>>;
+    typename Policy::point_type lower, upper;
+    typename Policy::tile_type tiles;
+    for (std::size_t d=0; d<NumSpaceDim; d++) {
+        lower[d] = min[d];
+        upper[d] = max[d];
+        tiles[d] = tuning.tile[d];
+    }
+    Kokkos::parallel_for(label, Policy(space, lower, upper, tiles), functor);
+}
+
+}
+
+#endif
@@ -2,26 +2,339 @@
 #define PFHUB_H
 
 #include <Cajita.hpp>
+#include <Integrators.hpp>
 #include <Runner.hpp>
 #include <PFVariables.hpp>
+#include <SpectralOperators.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <vector>
 
 namespace CabanaPF {
 
+//Error control for adaptive timestepping (see PFHub1aBase::set_adaptive)
+struct AdaptiveTimestepping {
+    double tolerance = 1e-5;    //allowed relative L2 error per timestep
+    double safety = .9;
+    double max_growth = 2;      //limits on how much dt changes from one timestep to the next
+    double max_shrink = .2;
+    double min_dt = 0;          //a timestep this small is taken regardless of its error
+    double max_dt = 0;          //0 for no limit
+};
+
 /*The PFHub Benchmark 1a: Spinodal Decomposition (https://pages.nist.gov/pfhub/benchmarks/benchmark1.ipynb/).  We have two versions:
     -PFHub1aBenchmark (which uses the actual benchmark initial conditions)
     -PFHub1aPeriodic (which uses similar but periodic initial conditions)
+Scalar is the precision the fields, spectra, and FFTs are stored and done in: float (e.g. BasicPFHub1aBenchmark<float>)
+halves the memory and communication, and is much faster on GPUs with little FP64.  The pointwise arithmetic, the
+reductions, and the diagnostics are still done in double either way.
 */
-class PFHub1aBase : public CabanaPFRunner<2> {
+template <class Scalar = double>
+class BasicPFHub1aBase : public CabanaPFRunner<2> {
 protected:
     using cdouble = Kokkos::complex<double>;
+    using Spectrum_type = typename FFT<2, Scalar>::Spectrum_type;
+    using Factor_type = Kokkos::View<Scalar**, Kokkos::LayoutLeft, exec_space::memory_space>;
+    using Field_type = Kokkos::View<Scalar***, exec_space::memory_space>;
 
     const double cell_size;
     const int timesteps;
     const int grid_points;
-    Kokkos::View<cdouble **, device_type> laplacian_view;
+    std::shared_ptr<SpectralOperators<2>> operators;  //k^2 and k^4 on this rank's part of the spectrum
+    SnapshotRegion<2> snapshot_region;  //what snapshot() writes; the whole grid by default
+    SnapshotFormat snapshot_format;     //and how; doubles by default
+
+    /*The semi-implicit update is c_hat = propagator.c*c_hat + propagator.dfdc*df_dc_hat, which only depends on dt.
+    Fixed timesteps reuse it; adaptive ones compute the factors inline instead (see propagate), since their dt is
+    different nearly every time.*/
+    struct Propagator {
+        double dt = 0;  //0: not built yet
+        Factor_type c;
+        Factor_type dfdc;
+    };
+    Propagator fixed_propagator;
+
+    //The propagator for dt, rebuilding it if dt has changed since it was last built
+    const Propagator& propagator(const double dt) {
+        auto& built = fixed_propagator;
+        if (built.dt == dt)
+            return built;
+        if (built.dt == 0) {
+            const auto extent = vars.spectrum_extent();
+            built.c = Factor_type("propagator c", extent[0], extent[1]);
+            built.dfdc = Factor_type("propagator df_dc", extent[0], extent[1]);
+        }
+        const auto k2 = operators->k2;
+        const auto k4 = operators->k4;
+        const auto c_factor = built.c;
+        const auto dfdc_factor = built.dfdc;
+        const double M = _M, KAPPA = _KAPPA;
+        spectral_parallel_for("propagator", k2, KOKKOS_LAMBDA(const int i, const int j) {
+            const double inverse_denominator = 1.0 / (1.0 + dt*M*KAPPA*k4(i, j));
+            c_factor(i, j) = inverse_denominator;
+            dfdc_factor(i, j) = -dt*M*k2(i, j)*inverse_denominator;
+        });
+        built.dt = dt;
+        return built;
+    }
+
+    //adaptive timestepping (see set_adaptive)
+    std::optional<AdaptiveTimestepping> adaptive;
+    double time;                //simulation time reached
+    double current_dt;          //size of the next timestep to try
+    long rejected;              //timesteps redone with a smaller dt
+
+    //a higher order integrator, in place of the built in semi-implicit Euler (see set_integrator)
+    std::shared_ptr<SpectralIntegrator<2, Scalar>> integrator;
+    SpectralOperators<2>::Operator_type linear;     //L = -M*KAPPA*k^4
+
+    /*df_dc in real space, from pre_step until step has transformed it.  It is leased from the runner's arena rather
+    than being a field of its own, so the memory is shared with the FFT workspace and the other temporaries.*/
+    ScratchArena::Scratch<Field_type> df_dc_field;
+
+    //A temporary spectrum from the arena, e.g. for the start of a timestep
+    ScratchArena::Scratch<Spectrum_type> lease_spectrum() {
+        const auto extent = vars.spectrum_extent();
+        return arena->view<Spectrum_type>(extent[0], extent[1]);
+    }
+
+    //Transform c and pre_step's df_dc together, and give df_dc's memory back
+    void forward_with_df_dc() {
+        const auto c_view = vars[0];
+        const auto dfdc_view = df_dc_field.view;
+        timers.start("fft_forward");
+        vars.template fft_forward_fused<2>(0, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, 2>& values) {
+            values[0] = c_view(i, j, 0);
+            values[1] = dfdc_view(i, j, 0);
+        });
+        timers.stop("fft_forward");
+        df_dc_field = {};
+    }
+
+    //Transform c, and df_dc evaluated from it on the way into the FFT (so it needs no real space storage)
+    void forward_evaluating_df_dc() {
+        const auto c_view = vars[0];
+        vars.template fft_forward_fused<2>(0, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, 2>& values) {
+            values[0] = c_view(i, j, 0);
+            values[1] = df_dc(values[0]);
+        });
+    }
+
+    //Transform c, then df_dc, evaluated from c on a second instance while c's reshapes communicate (see set_pipelined)
+    void forward_pipelined() {
+        const auto c_view = vars[0];
+        vars.template fft_forward_pipelined<1>(0, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, 1>& values) {
+            values[0] = c_view(i, j, 0);
+        }, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, 1>& values) {
+            values[0] = df_dc(c_view(i, j, 0));
+        });
+    }
+
+    bool pipelined;     //see set_pipelined
+
+    //Sums for the diagnostics of the timestep being taken, on this rank: bulk energy, mass, gradient energy, |c|^2, and |change|^2
+    std::array<double, 5> diagnostic_sums;
+
+    static KOKKOS_INLINE_FUNCTION double squared(const cdouble z) {
+        return z.real()*z.real() + z.imag()*z.imag();
+    }
+
+    //Semi-implicit update of c_hat, once both spectra are available
+    void spectral_update() {
+        const auto& step_propagator = propagator(END_TIME/timesteps);
+        const auto c_hat = vars.spectrum(0);
+        const auto df_dc_hat = vars.spectrum(1);
+        const auto c_factor = step_propagator.c;
+        const auto dfdc_factor = step_propagator.dfdc;
+
+        if (!diagnostics_due()) {
+            spectral_parallel_for("timestep", c_hat, KOKKOS_LAMBDA(const int i, const int j) {
+                c_hat(i, j) = c_factor(i, j)*c_hat(i, j) + dfdc_factor(i, j)*df_dc_hat(i, j);
+            });
+            return;
+        }
+        /*Same update, also summing the gradient energy and norm of the updated c and the norm of its change, by
+        Parseval's theorem.  The half spectrum stands in for its mirror image, except at x modes 0 and N/2.*/
+        const auto k2 = operators->k2;
+        const int x0 = vars.spectrum_offset()[0], points = grid_points;
+        Kokkos::parallel_reduce("timestep with diagnostics", Kokkos::MDRangePolicy<exec_space, SpectralRank<2>>({0, 0},
+                {c_hat.extent(0), c_hat.extent(1)}), KOKKOS_LAMBDA(const int i, const int j, double& gradient, double& norm, double& change) {
+            const cdouble old = c_hat(i, j);
+            const cdouble updated = c_factor(i, j)*old + dfdc_factor(i, j)*df_dc_hat(i, j);
+            c_hat(i, j) = updated;
+            const double weight = (i + x0 == 0 || 2*(i + x0) == points) ? 1 : 2;
+            gradient += weight * k2(i, j) * squared(updated);
+            norm += weight * squared(updated);
+            change += weight * squared(updated - old);
+        }, diagnostic_sums[2], diagnostic_sums[3], diagnostic_sums[4]);
+    }
+
+    /*Add up the diagnostic sums over all ranks and report them, at the end of a diagnostic timestep, once c is back
+    in real space.  Everything reported is of the state after the timestep, so the bulk sums are taken here.*/
+    void finish_diagnostics() {
+        if (!diagnostics_due())
+            return;
+        bulk_diagnostics();
+        MPI_Allreduce(MPI_IN_PLACE, diagnostic_sums.data(), diagnostic_sums.size(), MPI_DOUBLE, MPI_SUM, comm());
+        //the FFTs are unnormalized, so Fourier space sums of squares are N^2 times the real space ones
+        const double area = cell_size*cell_size;
+        const double points = static_cast<double>(grid_points)*grid_points;
+        Diagnostics diagnostics;
+        diagnostics.timestep = timesteps_done + 1;
+        diagnostics.time = adaptive ? time : diagnostics.timestep * (END_TIME/timesteps);
+        diagnostics.free_energy = area*diagnostic_sums[0] + _KAPPA/2 * area*diagnostic_sums[2]/points;
+        diagnostics.mass = area*diagnostic_sums[1];
+        diagnostics.l2_norm = std::sqrt(area*diagnostic_sums[3]/points);
+        diagnostics.l2_change = std::sqrt(area*diagnostic_sums[4]/points);
+        report_diagnostics(diagnostics);
+    }
+
+    //The bulk energy and mass sums of c
+    void bulk_diagnostics() {
+        const auto c_view = vars[0];
+        node_parallel_reduce("bulk diagnostics", KOKKOS_LAMBDA(const int i, const int j, double& bulk, double& mass) {
+            const double c = c_view(i, j, 0);
+            bulk += f_bulk(c);
+            mass += c;
+        }, diagnostic_sums[0], diagnostic_sums[1]);
+    }
+
+    /*A semi-implicit step of dt from c_in to c_out (which may be c_in), for adaptive timesteps: the propagator's
+    factors are computed in place rather than built for each new dt.*/
+    void propagate(const double dt, const Spectrum_type& c_in, const Spectrum_type& df_dc_in,
+        const Spectrum_type& c_out)
+    {
+        const auto k2 = operators->k2;
+        const auto k4 = operators->k4;
+        const double M = _M, KAPPA = _KAPPA;
+        spectral_parallel_for("propagate", c_in, KOKKOS_LAMBDA(const int i, const int j) {
+            const double inverse_denominator = 1.0 / (1.0 + dt*M*KAPPA*k4(i, j));
+            const Scalar c_factor = inverse_denominator;
+            const Scalar dfdc_factor = -dt*M*k2(i, j)*inverse_denominator;
+            c_out(i, j) = c_factor*c_in(i, j) + dfdc_factor*df_dc_in(i, j);
+        });
+    }
+
+    //The Fourier space sums of spectral_update's diagnostics, for a timestep from old_hat to new_hat
+    void spectral_diagnostics(const Spectrum_type& old_hat, const Spectrum_type& new_hat) {
+        const auto k2 = operators->k2;
+        const int x0 = vars.spectrum_offset()[0], points = grid_points;
+        Kokkos::parallel_reduce("spectral diagnostics", Kokkos::MDRangePolicy<exec_space, SpectralRank<2>>({0, 0},
+                {old_hat.extent(0), old_hat.extent(1)}), KOKKOS_LAMBDA(const int i, const int j, double& gradient, double& norm, double& change) {
+            const double weight = (i + x0 == 0 || 2*(i + x0) == points) ? 1 : 2;
+            gradient += weight * k2(i, j) * squared(new_hat(i, j));
+            norm += weight * squared(new_hat(i, j));
+            change += weight * squared(new_hat(i, j) - old_hat(i, j));
+        }, diagnostic_sums[2], diagnostic_sums[3], diagnostic_sums[4]);
+    }
+
+    /*One adaptive timestep by step doubling: a step of dt is compared with two of dt/2, and the relative difference
+    is the error estimate.  If it is within tolerance, the two half steps are kept; otherwise dt shrinks and the step
+    is redone.  Either way dt is then rescaled by safety*sqrt(tolerance/error), since the local error of semi-implicit
+    Euler goes as dt^2.  c must be in real space with df_dc computed (as after pre_step), and is left in real space.*/
+    void adaptive_step() {
+        const auto& options = *adaptive;
+        const auto c_hat = vars.spectrum(0);
+        const auto df_dc_hat = vars.spectrum(1);
+        //the spectra at the start of the step, and after one full dt
+        const auto c_start = lease_spectrum();
+        const auto df_dc_start = lease_spectrum();
+        const auto c_big = lease_spectrum();
+        const auto c_start_hat = c_start.view;
+        const auto df_dc_start_hat = df_dc_start.view;
+        const auto c_big_hat = c_big.view;
+        forward_with_df_dc();
+        Kokkos::deep_copy(c_start_hat, c_hat);
+        Kokkos::deep_copy(df_dc_start_hat, df_dc_hat);
+        while (true) {
+            const double dt = std::min(current_dt, END_TIME - time);
+            propagate(dt, c_start_hat, df_dc_start_hat, c_big_hat);
+            propagate(dt/2, c_start_hat, df_dc_start_hat, c_hat);
+            vars.fft_inverse(0);
+            forward_evaluating_df_dc();
+            propagate(dt/2, c_hat, df_dc_hat, c_hat);
+
+            //relative difference of the two answers, by Parseval's theorem (weighted as in spectral_diagnostics)
+            const auto big = c_big_hat;
+            const int x0 = vars.spectrum_offset()[0], points = grid_points;
+            double sums[2] = {0, 0};
+            Kokkos::parallel_reduce("step doubling error", Kokkos::MDRangePolicy<exec_space, SpectralRank<2>>({0, 0},
+                    {c_hat.extent(0), c_hat.extent(1)}), KOKKOS_LAMBDA(const int i, const int j, double& difference, double& norm) {
+                const double weight = (i + x0 == 0 || 2*(i + x0) == points) ? 1 : 2;
+                difference += weight * squared(c_hat(i, j) - big(i, j));
+                norm += weight * squared(c_hat(i, j));
+            }, sums[0], sums[1]);
+            MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, comm());
+            const double error = sums[1] > 0 ? std::sqrt(sums[0]/sums[1]) : 0;
+
+            const double factor = error > 0 ? options.safety*std::sqrt(options.tolerance/error) : options.max_growth;
+            const bool accept = error <= options.tolerance || dt <= options.min_dt;
+            current_dt = std::clamp(dt*std::clamp(factor, options.max_shrink, options.max_growth), options.min_dt,
+                options.max_dt > 0 ? options.max_dt : std::numeric_limits<double>::max());
+            if (accept) {
+                timers.start("fft_inverse");
+                vars.fft_inverse(0);
+                timers.stop("fft_inverse");
+                if (diagnostics_due())
+                    spectral_diagnostics(c_start_hat, c_hat);
+                time += dt;
+                return;
+            }
+            rejected++;
+        }
+    }
+
+    //N(u) = -M*k^2 * FFT(df_dc(c)), evaluated through real space in c's storage
+    void nonlinear(const Spectrum_type& state_hat, const Spectrum_type& result_hat) {
+        const auto c_view = vars[0];
+        Kokkos::deep_copy(vars.spectrum(0), state_hat);
+        vars.fft_inverse(0);
+        vars.template fft_forward_fused<1>(1, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, 1>& values) {
+            values[0] = df_dc(c_view(i, j, 0));
+        });
+        gradient_of(vars.spectrum(1), result_hat);
+    }
+
+    //result_hat = -M*k^2*df_dc_hat
+    void gradient_of(const Spectrum_type& df_dc_hat, const Spectrum_type& result_hat) {
+        const auto k2 = operators->k2;
+        const double M = _M;
+        spectral_parallel_for("nonlinear term", k2, KOKKOS_LAMBDA(const int i, const int j) {
+            result_hat(i, j) = -M*k2(i, j)*df_dc_hat(i, j);
+        });
+    }
+
+    //A timestep with the integrator, after pre_step has computed df_dc; leaves the result in c_hat for post_step
+    void integrator_step() {
+        const auto c_hat = vars.spectrum(0);
+        forward_with_df_dc();
+        //the integrator's state and N(u) at the start of the step, and c_hat then (for the diagnostics)
+        const auto u = lease_spectrum();
+        const auto n = lease_spectrum();
+        const auto u_hat = u.view;
+        const auto n_hat = n.view;
+        ScratchArena::Scratch<Spectrum_type> c_start;
+        if (diagnostics_due()) {
+            c_start = lease_spectrum();
+            Kokkos::deep_copy(c_start.view, c_hat);
+        }
+        Kokkos::deep_copy(u_hat, c_hat);
+        gradient_of(vars.spectrum(1), n_hat);
+        timers.start("integrator");
+        integrator->step(END_TIME/timesteps, linear, u_hat, n_hat, [this](const auto& state, const auto& result) {
+            nonlinear(state, result);
+        });
+        timers.stop("integrator");
+        Kokkos::deep_copy(c_hat, u_hat);
+        if (diagnostics_due())
+            spectral_diagnostics(c_start.view, c_hat);
+    }
 
 public:
-    PFVariables<2, 2> vars;
+    PFVariables<2, 1, Scalar, 2> vars;     //c, with spectra for c and df_dc
     static constexpr double _SIZE = 200.;
     static constexpr double END_TIME = 250.;
     static constexpr double _KAPPA = 2.;
@@ -30,129 +343,488 @@ public:
     static constexpr double _C_ALPHA = .3;
     static constexpr double _C_BETA = .7;
 
-    PFHub1aBase(int grid_points, int timesteps) : CabanaPFRunner(grid_points, timesteps, _SIZE),
-        cell_size{_SIZE/grid_points}, timesteps{timesteps}, grid_points{grid_points}, vars{layout, {"c", "df_dc"}}
+    //The bulk free energy density
+    static KOKKOS_INLINE_FUNCTION double f_bulk(const double c) {
+        return _RHO * (c-_C_ALPHA)*(c-_C_ALPHA)*(_C_BETA-c)*(_C_BETA-c);
+    }
+
+    //The chemical potential from the bulk free energy, RHO*(c-C_ALPHA)^2*(C_BETA-c)^2
+    static KOKKOS_INLINE_FUNCTION double df_dc(const double c) {
+        return _RHO * (2.0*(c-_C_ALPHA)*(_C_BETA-c)*(_C_BETA-c) - 2.0*(_C_BETA-c)*(c-_C_ALPHA)*(c-_C_ALPHA));
+    }
+
+    BasicPFHub1aBase(int grid_points, int timesteps, MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<2>& decomposition = Decomposition<2>())
+        : CabanaPFRunner(grid_points, timesteps, _SIZE, 1, comm, decomposition),
+        cell_size{_SIZE/grid_points}, timesteps{timesteps}, grid_points{grid_points}, vars{layout, {"c"}, decomposition.fft, arena}
     {
-        laplacian_view = Kokkos::View<cdouble **, device_type> ("laplacian", grid_points, grid_points);
+        operators = PlanCache::operators<2>(vars.spectrum_offset(), vars.spectrum_extent(), grid_points, _SIZE);
+        time = 0;
+        current_dt = END_TIME/timesteps;
+        rejected = 0;
+        pipelined = false;
+    }
+
+    /*Choose each timestep's size by error control rather than using END_TIME/timesteps, which is only the first one
+    tried.  The run then ends when it reaches END_TIME, however many timesteps that takes.*/
+    void set_adaptive(const AdaptiveTimestepping& options) {
+        if (integrator)
+            throw std::invalid_argument("Adaptive timestepping only supports the built in integrator");
+        const double reached = simulation_time();   //so a run switched to adaptive mid-way carries on from there
+        adaptive = options;
+        time = reached;
+    }
+
+    /*Integrate with a higher order scheme (e.g. ETDRK4) instead of semi-implicit Euler.  Each step then costs the
+    integrator's stages() extra inverse and forward FFTs, in exchange for larger timesteps at the same error.
+    Not combined with adaptive timestepping, and timesteps are not fused.  Pass nullptr to go back to semi-implicit Euler.*/
+    void set_integrator(std::shared_ptr<SpectralIntegrator<2, Scalar>> scheme) {
+        if (scheme && adaptive)
+            throw std::invalid_argument("Adaptive timestepping only supports the built in integrator");
+        integrator = scheme;
+        reset_graph();
+        if (integrator && !linear.is_allocated()) {
+            linear = SpectralOperators<2>::create("linear operator", vars.spectrum_extent());
+            const auto k4 = operators->k4;
+            const auto L = linear;
+            const double M = _M, KAPPA = _KAPPA;
+            spectral_parallel_for("linear operator", k4, KOKKOS_LAMBDA(const int i, const int j) {
+                L(i, j) = -M*KAPPA*k4(i, j);
+            });
+        }
+    }
+
+    /*Transform c and df_dc one after the other rather than as one batch, computing df_dc on a second execution space
+    instance while c's transform communicates (see PFVariables::fft_forward_pipelined).  Meant for GPU runs on many
+    ranks, where the reshapes take most of the timestep; otherwise the batch is faster.  Only for the built in
+    integrator with a fixed timestep; heFFTe's p2p_plined algorithm (see FFTOptions) pipelines within each reshape too.*/
+    void set_pipelined(const bool value) {
+        pipelined = value;
+        reset_graph();
+    }
+
+    //The size of the next timestep (fixed unless adaptive)
+    double timestep_size() const {
+        return adaptive ? current_dt : END_TIME/timesteps;
+    }
+
+    //How many adaptive timesteps had to be redone with a smaller dt
+    long rejected_timesteps() const {
+        return rejected;
+    }
+
+    bool finished() const override {
+        return adaptive ? time >= END_TIME*(1 - 1e-12) : timesteps_done >= timesteps;
+    }
+
+    //The fixed size semi-implicit timestep is the same kernels and FFTs every time; the others fence and copy along the way
+    bool capturable() const override {
+        return !adaptive && !integrator && !pipelined;
+    }
+
+    /*Rough memory traffic (bytes) of the pointwise kernels over the whole grid in one timestep, not counting
+    heFFTe's own passes.  Used to report an effective bandwidth.*/
+    double bytes_per_step() const {
+        const double points = static_cast<double>(grid_points) * grid_points;
+        const double spectral_points = static_cast<double>(grid_points/2 + 1) * grid_points;
+        //real space: df_dc (read c, write df_dc) and packing both fields, or both done at once when fused; then unpacking c
+        const double real_bytes = fused ? (8 + 16 + 16) : (16 + 32 + 16);
+        //Fourier space: read c_hat, df_dc_hat, and both propagator factors; write c_hat
+        //the sizes above are for doubles, and everything is stored as Scalar
+        return (real_bytes*points + (16 + 16 + 16 + 16)*spectral_points) * sizeof(Scalar)/sizeof(double);
     }
 
     double get_c(int i, int j) {
         return vars[0](i, j, 0);
     }
 
+    std::string fft_plan() const {
+        return vars.fft_plan();
+    }
+
     auto get_cpu_view() {
         return vars.host_view(0);
     }
 
+    /*Write every field and the step count so far to a checkpoint named after run_name, for restart().  With async,
+    the write overlaps with the following timesteps (see PFVariables::checkpoint).*/
+    void checkpoint(const std::string& run_name, const bool async = false) {
+        timers.start("io");
+        vars.checkpoint(run_name, {timesteps_done, timestep_size(), simulation_time()}, async);
+        timers.stop("io");
+    }
+
+    void wait_for_output() {
+        vars.wait_for_output();
+    }
+
+    //Continue from the checkpoint written after from_timestep timesteps, instead of from the initial conditions
+    void restart(const std::string& run_name, const int from_timestep) {
+        timers.start("io");
+        const auto info = vars.restart(run_name, from_timestep);
+        timers.stop("io");
+        if (adaptive) {
+            time = info.time;
+            current_dt = info.dt;
+        } else if (info.dt != END_TIME/timesteps) {
+            throw std::runtime_error("Checkpoint " + run_name + " was written with a different timestep size");
+        }
+        timesteps_done = info.timesteps_done;
+        have_initialized = true;
+    }
+
     //Problem-specific initial conditions
     virtual void initial_conditions()=0;
+    //Prefix for this run's output files
+    virtual std::string run_name() const=0;
+
+    double simulation_time() const override {
+        return adaptive ? time : timesteps_done * (END_TIME/timesteps);
+    }
+
+    //Limit scheduled snapshots (see set_output_interval and set_output_times) to a region and/or every stride-th point
+    void set_snapshot_region(const SnapshotRegion<2>& region) {
+        snapshot_region = region;
+    }
+
+    //Store scheduled snapshots as floats or error-bounded integers instead of doubles
+    void set_snapshot_format(const SnapshotFormat& format) {
+        snapshot_format = format;
+    }
+
+    //Called by the output schedule: writes c, with the timestep in the file name
+    void snapshot() override {
+        vars.snapshot(0, run_name(), timesteps_done, simulation_time(), snapshot_region, snapshot_format);
+    }
     
     void initialize() override {
-        //setup the laplacian:
-        const auto laplacian = laplacian_view;
-        const auto points = grid_points;
-        const double SIZE = _SIZE;
-
-        node_parallel_for("laplacian", KOKKOS_LAMBDA(const int i, const int j) {
-            const auto kx = cdouble(0.0, 2*M_PI/points)
-                    * static_cast<double>(i > points/2 ? i - points : 2*i == points ? 0 : i);
-            const auto ky = cdouble(0.0, 2*M_PI/points)
-                * static_cast<double>(j > points/2 ? j - points : 2*j == points ? 0 : j);
-            laplacian(i, j) = (kx*kx + ky*ky) * static_cast<double>(points * points) / (SIZE*SIZE);
-        });
         //have the problem do its setup:
         initial_conditions();
     }
 
     void pre_step() override {
+        if (pipelined && !adaptive && !integrator)     //df_dc is evaluated during the forward transform instead
+            return;
         //Calculate df_dc values:
         const auto c_view = vars[0];
-        const auto dfdc_view = vars[1];
-        const double RHO = _RHO, C_ALPHA = _C_ALPHA, C_BETA = _C_BETA;
-
+        df_dc_field = arena->view<Field_type>(c_view.extent(0), c_view.extent(1), 1);
+        const auto dfdc_view = df_dc_field.view;
         node_parallel_for("df_dc", KOKKOS_LAMBDA( const int i, const int j) {
-            const cdouble c(c_view(i, j, 0), c_view(i, j, 1));
-            const cdouble df_dc = RHO * (2.0*(c-C_ALPHA)*(C_BETA-c)*(C_BETA-c) - 2.0*(C_BETA-c)*(c-C_ALPHA)*(c-C_ALPHA));
-            dfdc_view(i, j, 0) = df_dc.real();
-            dfdc_view(i, j, 1) = df_dc.imag();
+            dfdc_view(i, j, 0) = df_dc(c_view(i, j, 0));
         });
     }
 
     void step() override {
+        if (adaptive) {
+            adaptive_step();
+            return;
+        }
+        if (integrator) {
+            integrator_step();
+            return;
+        }
         //enter Fourier space:
-        vars.fft_forward(0);
-        vars.fft_forward(1);
-        
-        const double dt = END_TIME/timesteps;
-        const double M = _M, KAPPA = _KAPPA;
-        const auto c = vars[0];
-        const auto df_dc = vars[1];
-        const auto laplacian = laplacian_view;
-
-        node_parallel_for("timestep", KOKKOS_LAMBDA(const int i, const int j) {
-            const cdouble df_dc_hat(df_dc(i, j, 0), df_dc(i, j, 1));
-            cdouble c_hat(c(i, j, 0), c(i, j, 1));
-
-            c_hat = (c_hat + dt*M*laplacian(i, j)*df_dc_hat) / (1.0 + dt*M*KAPPA*laplacian(i, j)*laplacian(i, j));
-            c(i, j, 0) = c_hat.real();
-            c(i, j, 1) = c_hat.imag();
-        });
+        if (pipelined) {
+            timers.start("fft_forward");
+            forward_pipelined();
+            timers.stop("fft_forward");
+        } else {
+            forward_with_df_dc();
+        }
+        timers.start("spectral_update");
+        spectral_update();
+        timers.stop("spectral_update");
     }
 
     void post_step() override {
+        if (adaptive) {    //adaptive_step is already back in real space
+            finish_diagnostics();
+            return;
+        }
         //rescue concentration values from Fourier space:
+        timers.start("fft_inverse");
         vars.fft_inverse(0);
+        timers.stop("fft_inverse");
+        finish_diagnostics();
+    }
+
+    //All three phases in one: df_dc is evaluated while c is packed for the FFT, and is never stored in real space
+    void fused_step() override {
+        if (adaptive || integrator) {    //these evaluate df_dc from stored real space fields, so aren't fused
+            pre_step();
+            step();
+            post_step();
+            return;
+        }
+        timers.start("fft_forward");
+        if (pipelined)
+            forward_pipelined();
+        else
+            forward_evaluating_df_dc();
+        timers.stop("fft_forward");
+        timers.start("spectral_update");
+        spectral_update();
+        timers.stop("spectral_update");
+        timers.start("fft_inverse");
+        vars.fft_inverse(0);
+        timers.stop("fft_inverse");
+        finish_diagnostics();
     }
 };
 
-class PFHub1aBenchmark : public PFHub1aBase {
+using PFHub1aBase = BasicPFHub1aBase<double>;
+
+template <class Scalar = double>
+class BasicPFHub1aBenchmark final : public StaticTimestep<BasicPFHub1aBenchmark<Scalar>, BasicPFHub1aBase<Scalar>> {
+    using Static = StaticTimestep<BasicPFHub1aBenchmark<Scalar>, BasicPFHub1aBase<Scalar>>;
 public:
+    //c at the start, at position (x, y)
+    static KOKKOS_INLINE_FUNCTION double initial_c(const double x, const double y) {
+        return .5 + .01*(Kokkos::cos(.105*x)*Kokkos::cos(.11*y)
+            + Kokkos::cos(.13*x)*Kokkos::cos(.087*y)*Kokkos::cos(.13*x)*Kokkos::cos(.087*y)
+            + Kokkos::cos(.025*x-.15*y)*Kokkos::cos(.07*x-.02*y));
+    }
+
     void initial_conditions() override {
-        const auto c = vars[0];   //get View for scope capture
-        const auto delta = cell_size;
-        node_parallel_for("benchmark initial conditions", KOKKOS_LAMBDA(const int i, const int j) {
-            //initialize c:
-            const double x = delta*i;
-            const double y = delta*j;
-            c(i, j, 0) = .5 + .01*(Kokkos::cos(.105*x)*Kokkos::cos(.11*y)
-                + Kokkos::cos(.13*x)*Kokkos::cos(.087*y)*Kokkos::cos(.13*x)*Kokkos::cos(.087*y)
-                + Kokkos::cos(.025*x-.15*y)*Kokkos::cos(.07*x-.02*y));
-            c(i, j, 1) = 0;
+        const auto c = this->vars[0];   //get View for scope capture
+        const auto delta = this->cell_size;
+        const auto offset = this->local_to_global();    //this rank's block starts there
+        const int x0 = offset[0], y0 = offset[1];
+        this->node_parallel_for("benchmark initial conditions", KOKKOS_LAMBDA(const int i, const int j) {
+            c(i, j, 0) = initial_c(delta*(i + x0), delta*(j + y0));
         });
     }
 
-    void output() {
+    static std::string run_name_for(const int grid_points, const int timesteps) {
         std::stringstream s;
         s << "1aBenchmark_N" << grid_points << "T" << timesteps;
-        vars.save(0, s.str());
+        return s.str();
+    }
+
+    std::string run_name() const override {
+        return run_name_for(this->grid_points, this->timesteps);
+    }
+
+    void output() {
+        this->timers.start("io");
+        this->vars.save(0, run_name());
+        this->timers.stop("io");
     }
 
-    PFHub1aBenchmark(int grid_points, int timesteps) : PFHub1aBase{grid_points, timesteps} {}
+    BasicPFHub1aBenchmark(int grid_points, int timesteps, MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<2>& decomposition = Decomposition<2>())
+        : Static{grid_points, timesteps, comm, decomposition} {}
 };
 
-class PFHub1aPeriodic : public PFHub1aBase {
+using PFHub1aBenchmark = BasicPFHub1aBenchmark<double>;
+
+template <class Scalar = double>
+class BasicPFHub1aPeriodic final : public StaticTimestep<BasicPFHub1aPeriodic<Scalar>, BasicPFHub1aBase<Scalar>> {
+    using Static = StaticTimestep<BasicPFHub1aPeriodic<Scalar>, BasicPFHub1aBase<Scalar>>;
 public:
+    //c at the start, at position (x, y)
+    static KOKKOS_INLINE_FUNCTION double initial_c(const double x, const double y) {
+        return .5 + .01*(Kokkos::cos(3*M_PI*x/100)*Kokkos::cos(M_PI*y/25)
+            + Kokkos::cos(M_PI*x/25)*Kokkos::cos(3*M_PI*y/100)*Kokkos::cos(M_PI*x/25)*Kokkos::cos(3*M_PI*y/100)
+            + Kokkos::cos(M_PI*x/100-M_PI*y/20)*Kokkos::cos(M_PI*x/50-M_PI*y/100));
+    }
+
     void initial_conditions() override {
-        const auto c = vars[0];   //get View for scope capture
-        const auto delta = cell_size;
-        node_parallel_for("periodic initial conditions", KOKKOS_LAMBDA(const int i, const int j) {
-            //initialize c:
-            const double x = delta*i;
-            const double y = delta*j;
-            c(i, j, 0) = .5 + .01*(Kokkos::cos(3*M_PI*x/100)*Kokkos::cos(M_PI*y/25)
-                + Kokkos::cos(M_PI*x/25)*Kokkos::cos(3*M_PI*y/100)*Kokkos::cos(M_PI*x/25)*Kokkos::cos(3*M_PI*y/100)
-                + Kokkos::cos(M_PI*x/100-M_PI*y/20)*Kokkos::cos(M_PI*x/50-M_PI*y/100));
-            c(i, j, 1) = 0;
+        const auto c = this->vars[0];   //get View for scope capture
+        const auto delta = this->cell_size;
+        const auto offset = this->local_to_global();    //this rank's block starts there
+        const int x0 = offset[0], y0 = offset[1];
+        this->node_parallel_for("periodic initial conditions", KOKKOS_LAMBDA(const int i, const int j) {
+            c(i, j, 0) = initial_c(delta*(i + x0), delta*(j + y0));
         });
     }
 
-    void output() {
+    static std::string run_name_for(const int grid_points, const int timesteps) {
         std::stringstream s;
         s << "1aPeriodic_N" << grid_points << "T" << timesteps;
-        vars.save(0, s.str());
+        return s.str();
+    }
+
+    std::string run_name() const override {
+        return run_name_for(this->grid_points, this->timesteps);
+    }
+
+    void output() {
+        this->timers.start("io");
+        this->vars.save(0, run_name());
+        this->timers.stop("io");
+    }
+
+    BasicPFHub1aPeriodic(int grid_points, int timesteps, MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<2>& decomposition = Decomposition<2>())
+        : Static{grid_points, timesteps, comm, decomposition} {}
+};
+
+using PFHub1aPeriodic = BasicPFHub1aPeriodic<double>;
+
+/*Several independent PFHub1a runs on the same grid, advanced together so that small grids keep the device busy.
+Each timestep is one kernel for df_dc over every member, one batched forward FFT, one spectral update, and one
+batched inverse FFT, however many members there are, so the launches and heFFTe's reshapes are shared.  Members may
+have different numbers of timesteps (so different dt, as in a dt convergence study): each stops after its own, and
+the ensemble is finished with the longest.  Only the semi-implicit integrator, without diagnostics.  See
+PFHub1aEnsemble for the initial conditions.*/
+class PFHub1aEnsembleBase : public CabanaPFRunner<2> {
+protected:
+    using memory_space = exec_space::memory_space;
+    using Array_type = Cajita::Array<double, Cajita::Node, Mesh, memory_space>;
+
+    static int longest(const std::vector<int>& timesteps) {
+        if (timesteps.empty())
+            throw std::invalid_argument("An ensemble needs at least one member");
+        return *std::max_element(timesteps.begin(), timesteps.end());
+    }
+
+    const double cell_size;
+    const std::vector<int> member_timesteps;    //in the order given
+    std::vector<int> component;                 //the component of c holding each member
+    std::vector<int> component_timesteps;       //sorted, longest first, so the members still going come first
+    int running;                                //how many members are still going
+    std::shared_ptr<Array_type> c;              //each component is one member's c
+    std::shared_ptr<FFT<2>> fft;
+    FFT<2>::Batch_type spectra;                 //c_hat of each running member, then df_dc_hat of each
+    std::shared_ptr<SpectralOperators<2>> operators;
+    Kokkos::View<double*, memory_space> dt;     //by component
+    std::shared_ptr<PFVariables<2, 1>> output_vars;     //a single member's c, for output()
+
+public:
+    PFHub1aEnsembleBase(int grid_points, const std::vector<int>& timesteps, MPI_Comm comm = MPI_COMM_WORLD,
+            const Decomposition<2>& decomposition = Decomposition<2>())
+        : CabanaPFRunner(grid_points, longest(timesteps), PFHub1aBase::_SIZE, 1, comm, decomposition),
+        cell_size{PFHub1aBase::_SIZE/grid_points}, member_timesteps{timesteps}, component(timesteps.size()),
+        fft{PlanCache::fft<2>(*layout, 2*static_cast<int>(timesteps.size()), decomposition.fft, arena)},
+        operators{PlanCache::operators<2>(fft->spectrum_offset(), fft->spectrum_extent(), grid_points, PFHub1aBase::_SIZE)}
+    {
+        const int members = timesteps.size();
+        std::vector<int> by_length(members);
+        std::iota(by_length.begin(), by_length.end(), 0);
+        std::stable_sort(by_length.begin(), by_length.end(), [&](const int a, const int b) { return timesteps[a] > timesteps[b]; });
+        dt = Kokkos::View<double*, memory_space>("ensemble dt", members);
+        const auto dt_host = Kokkos::create_mirror_view(dt);
+        for (int s=0; s<members; s++) {
+            component[by_length[s]] = s;
+            component_timesteps.push_back(timesteps[by_length[s]]);
+            dt_host(s) = PFHub1aBase::END_TIME / timesteps[by_length[s]];
+        }
+        Kokkos::deep_copy(dt, dt_host);
+        running = std::count_if(timesteps.begin(), timesteps.end(), [](const int t) { return t > 0; });
+        const auto members_layout = PlanCache::layout<2>(local_grid, members);
+        c = Cajita::createArray<double, memory_space>("c", members_layout);
+        spectra = fft->create_spectra("ensemble spectra", 2*members);
+    }
+
+    int members() const {
+        return member_timesteps.size();
+    }
+
+    //Problem-specific initial conditions, for every member
+    virtual void initial_conditions()=0;
+    //Prefix for a member's output files, as the single run would use
+    virtual std::string run_name(const int member) const=0;
+
+    void initialize() override {
+        initial_conditions();
+    }
+
+    //Members that have done all their timesteps drop out of the batch
+    void pre_step() override {
+        const int before = running;
+        while (running > 0 && component_timesteps[running-1] <= timesteps_done)
+            running--;
+        if (running != before)
+            reset_graph();
+    }
+
+    void step() override {
+        const int n = running;
+        const auto c_view = c->view();
+        timers.start("fft_forward");
+        //c then df_dc of each running member, packed in one sweep
+        fft->pack_slots(2*n, KOKKOS_LAMBDA(const int i, const int j, const int slot) {
+            return slot < n ? c_view(i, j, slot) : PFHub1aBase::df_dc(c_view(i, j, slot - n));
+        });
+        fft->forward_packed(2*n, spectra.data());
+        timers.stop("fft_forward");
+
+        timers.start("spectral_update");
+        //the semi-implicit update of PFHub1aBase, with each member's own dt
+        const auto all = spectra;
+        const auto k2 = operators->k2;
+        const auto k4 = operators->k4;
+        const auto member_dt = dt;
+        const double M = PFHub1aBase::_M, KAPPA = PFHub1aBase::_KAPPA;
+        Kokkos::parallel_for("ensemble timestep", Kokkos::MDRangePolicy<exec_space, SpectralRank<3>>({0, 0, 0},
+                {all.extent(0), all.extent(1), static_cast<std::size_t>(n)}), KOKKOS_LAMBDA(const int i, const int j, const int s) {
+            const double step_dt = member_dt(s);
+            const double inverse_denominator = 1.0 / (1.0 + step_dt*M*KAPPA*k4(i, j));
+            const double c_factor = inverse_denominator;
+            const double dfdc_factor = -step_dt*M*k2(i, j)*inverse_denominator;
+            all(i, j, s) = c_factor*all(i, j, s) + dfdc_factor*all(i, j, n+s);
+        });
+        timers.stop("spectral_update");
+
+        timers.start("fft_inverse");
+        fft->reverse_packed(n, spectra.data());
+        fft->unpack_slots(n, KOKKOS_LAMBDA(const int i, const int j, const int slot, const double value) {
+            c_view(i, j, slot) = value;
+        });
+        timers.stop("fft_inverse");
+    }
+
+    //The set of running members only changes in pre_step, which a replayed graph would skip
+    bool capturable() const override {
+        return running > 0 && component_timesteps[running-1] > timesteps_done;
+    }
+
+    int timesteps_of(const int member) const {
+        return member_timesteps[member];
+    }
+
+    //One member's c, copied to the host, indexed like PFHub1aBase::get_cpu_view
+    auto get_cpu_view(const int member) {
+        const int s = component[member];
+        return Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(),
+            Kokkos::subview(c->view(), Kokkos::ALL(), Kokkos::ALL(), std::make_pair(s, s+1)));
+    }
+
+    //Write one member's c to the file the single run's output() would
+    void output(const int member) {
+        timers.start("io");
+        if (!output_vars)
+            output_vars = std::make_shared<PFVariables<2, 1>>(layout, std::array<std::string, 1>{"c"}, decomposition.fft, arena);
+        const int s = component[member];
+        Kokkos::deep_copy((*output_vars)[0], Kokkos::subview(c->view(), Kokkos::ALL(), Kokkos::ALL(), std::make_pair(s, s+1)));
+        output_vars->save(0, run_name(member));
+        timers.stop("io");
+    }
+};
+
+//An ensemble of PFHub1aBenchmark or PFHub1aPeriodic runs, given the timesteps of each
+template <class Problem>
+class PFHub1aEnsemble final : public StaticTimestep<PFHub1aEnsemble<Problem>, PFHub1aEnsembleBase> {
+    using Static = StaticTimestep<PFHub1aEnsemble<Problem>, PFHub1aEnsembleBase>;
+public:
+    void initial_conditions() override {
+        const auto c = this->c->view();
+        const auto delta = this->cell_size;
+        const int members = this->members();
+        const auto offset = this->local_to_global();
+        const int x0 = offset[0], y0 = offset[1];
+        this->node_parallel_for("ensemble initial conditions", KOKKOS_LAMBDA(const int i, const int j) {
+            const double value = Problem::initial_c(delta*(i + x0), delta*(j + y0));
+            for (int s=0; s<members; s++)
+                c(i, j, s) = value;
+        });
+    }
+
+    std::string run_name(const int member) const override {
+        return Problem::run_name_for(this->grid_points, this->member_timesteps[member]);
     }
 
-    PFHub1aPeriodic(int grid_points, int timesteps) : PFHub1aBase{grid_points, timesteps} {}
+    PFHub1aEnsemble(int grid_points, const std::vector<int>& timesteps, MPI_Comm comm = MPI_COMM_WORLD,
+            const Decomposition<2>& decomposition = Decomposition<2>())
+        : Static{grid_points, timesteps, comm, decomposition} {}
 };
 
 }
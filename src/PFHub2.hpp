@@ -0,0 +1,268 @@
+#ifndef PFHUB2_H
+#define PFHUB2_H
+
+#include <Cajita.hpp>
+#include <PFVariables.hpp>
+#include <Runner.hpp>
+#include <SpectralOperators.hpp>
+
+#include <array>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace CabanaPF {
+
+/*PFHub benchmark 2's free energy and kinetics (the defaults are the benchmark's):
+    f = f_alpha(c)*(1-h) + f_beta(c)*h + W*g,  with f_alpha = RHO2*(c-C_ALPHA)^2, f_beta = RHO2*(C_BETA-c)^2,
+    h = sum eta_i^3*(6*eta_i^2 - 15*eta_i + 10),  g = sum eta_i^2*(1-eta_i)^2 + ALPHA*sum_i sum_{j!=i} eta_i^2*eta_j^2,
+plus KAPPA_C/2*|grad c|^2 and KAPPA_ETA/2*|grad eta_i|^2.  c is conserved (Cahn-Hilliard, mobility M) and the order
+parameters are not (Allen-Cahn, mobility L).*/
+struct PFHub2Parameters {
+    double size = 200.;         //length of the (square) domain's sides
+    double end_time = 1000.;
+    double c_alpha = .3;
+    double c_beta = .7;
+    double rho2 = 2.;
+    double alpha = 5.;
+    double w = 1.;
+    double mobility = 5.;       //M
+    double relaxation = 5.;     //L
+    double kappa_c = 3.;
+    double kappa_eta = 3.;
+};
+
+/*Coupled Cahn-Hilliard/Allen-Cahn with NumOrderParameters order parameters, by the same semi-implicit spectral
+update as PFHub1a, on a periodic domain.  The cost per timestep doesn't grow in launches with the number of fields:
+    -one kernel reads every field at a point and evaluates all the chemical potentials together, writing fields and
+     potentials straight into the FFT's work buffer (so the potentials need no real space storage)
+    -one batched FFT transforms all of them, sharing one set of reshapes
+    -one kernel updates every field's spectrum, with the propagators computed from k^2 and k^4 in place
+    -one batched inverse FFT, unpacked into every field by one kernel
+Variable 0 is c, and 1 to NumOrderParameters are the eta_i.  See PFHub2Benchmark for initial conditions.*/
+template <std::size_t NumOrderParameters, class Scalar = double>
+class PFHub2Base : public CabanaPFRunner<2> {
+public:
+    static constexpr std::size_t NumFields = 1 + NumOrderParameters;
+
+protected:
+    using exec_space = CabanaPFRunner<2>::exec_space;
+    using View_type = Kokkos::View<Scalar***, exec_space::memory_space>;
+    using Spectrum_type = typename FFT<2, Scalar>::Spectrum_type;
+    using cscalar = Kokkos::complex<Scalar>;
+
+    const PFHub2Parameters parameters;
+    const double cell_size;
+    const double dt;
+    std::shared_ptr<SpectralOperators<2>> operators;
+
+    static std::array<std::string, NumFields> names() {
+        std::array<std::string, NumFields> all;
+        all[0] = "c";
+        for (std::size_t q=1; q<NumFields; q++)
+            all[q] = "eta" + std::to_string(q);
+        return all;
+    }
+
+    Kokkos::Array<View_type, NumFields> fields() {
+        Kokkos::Array<View_type, NumFields> all;
+        for (std::size_t v=0; v<NumFields; v++)
+            all[v] = vars[v];
+        return all;
+    }
+
+public:
+    /*df/dc and each df/deta_q at a point: given every field's value there in values[v] (c, then the eta_q), sets
+    values[NumFields + v] to field v's, so they are packed for the FFT right after the fields themselves*/
+    static KOKKOS_INLINE_FUNCTION void chemical_potentials(Kokkos::Array<double, 2*NumFields>& values, const PFHub2Parameters& p) {
+        const double c = values[0];
+        double h = 0, sum_squares = 0;
+        for (std::size_t q=1; q<NumFields; q++) {
+            const double eta = values[q];
+            h += eta*eta*eta*(6*eta*eta - 15*eta + 10);
+            sum_squares += eta*eta;
+        }
+        const double f_alpha = p.rho2*(c-p.c_alpha)*(c-p.c_alpha);
+        const double f_beta = p.rho2*(p.c_beta-c)*(p.c_beta-c);
+        values[NumFields] = 2*p.rho2*(c-p.c_alpha)*(1-h) - 2*p.rho2*(p.c_beta-c)*h;
+        for (std::size_t q=1; q<NumFields; q++) {
+            const double eta = values[q];
+            const double others = sum_squares - eta*eta;
+            const double dh = 30*eta*eta*(1-eta)*(1-eta);
+            const double dg = 2*eta*(1-eta)*(1-eta) - 2*eta*eta*(1-eta) + 4*p.alpha*eta*others;
+            values[NumFields + q] = (f_beta - f_alpha)*dh + p.w*dg;
+        }
+    }
+
+    PFVariables<2, NumFields, Scalar, 2*NumFields> vars;    //c and the eta_i, with spectra for them and their potentials
+
+    PFHub2Base(int grid_points, int timesteps, const PFHub2Parameters& parameters = PFHub2Parameters(),
+            MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<2>& decomposition = Decomposition<2>())
+        : CabanaPFRunner<2>(grid_points, timesteps, parameters.size, 1, comm, decomposition),
+        parameters{parameters}, cell_size{parameters.size/grid_points}, dt{parameters.end_time/timesteps},
+        vars{layout, names(), decomposition.fft, arena}
+    {
+        operators = PlanCache::operators<2>(vars.spectrum_offset(), vars.spectrum_extent(), grid_points, parameters.size);
+    }
+
+    //Problem-specific initial conditions
+    virtual void initial_conditions()=0;
+    //Prefix for this run's output files
+    virtual std::string run_name() const=0;
+
+    double timestep_size() const {
+        return dt;
+    }
+
+    double simulation_time() const override {
+        return timesteps_done * dt;
+    }
+
+    //Every timestep is the same kernels and FFTs
+    bool capturable() const override {
+        return true;
+    }
+
+    std::string fft_plan() const {
+        return vars.fft_plan();
+    }
+
+    //A host copy of field v (0 for c, q for eta_q)
+    auto get_cpu_view(const int v = 0) {
+        return vars.host_view(v);
+    }
+
+    //Write every field and the step count so far to a checkpoint named after run_name, for restart()
+    void checkpoint(const std::string& run_name, const bool async = false) {
+        timers.start("io");
+        vars.checkpoint(run_name, {timesteps_done, dt, simulation_time()}, async);
+        timers.stop("io");
+    }
+
+    void wait_for_output() {
+        vars.wait_for_output();
+    }
+
+    //Continue from the checkpoint written after from_timestep timesteps, instead of from the initial conditions
+    void restart(const std::string& run_name, const int from_timestep) {
+        timers.start("io");
+        const auto info = vars.restart(run_name, from_timestep);
+        timers.stop("io");
+        if (info.dt != dt)
+            throw std::runtime_error("Checkpoint " + run_name + " was written with a different timestep size");
+        timesteps_done = info.timesteps_done;
+        have_initialized = true;
+    }
+
+    void output() {
+        timers.start("io");
+        for (std::size_t v=0; v<NumFields; v++)
+            vars.save(v, run_name());
+        timers.stop("io");
+    }
+
+    //Called by the output schedule: writes every field, with the timestep in the file names
+    void snapshot() override {
+        for (std::size_t v=0; v<NumFields; v++)
+            vars.snapshot(v, run_name(), timesteps_done, simulation_time());
+    }
+
+    void initialize() override {
+        initial_conditions();
+    }
+
+    //Every field and potential into Fourier space, then the semi-implicit update of every field, in one kernel each
+    void step() override {
+        const auto u = fields();
+        const PFHub2Parameters p = parameters;
+        timers.start("fft_forward");
+        vars.template fft_forward_fused<2*NumFields>(0, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, 2*NumFields>& values) {
+            for (std::size_t v=0; v<NumFields; v++)
+                values[v] = u[v](i, j, 0);
+            chemical_potentials(values, p);
+        });
+        timers.stop("fft_forward");
+
+        timers.start("spectral_update");
+        Kokkos::Array<Spectrum_type, 2*NumFields> hat;
+        for (std::size_t s=0; s<2*NumFields; s++)
+            hat[s] = vars.spectrum(s);
+        const auto k2 = operators->k2;
+        const auto k4 = operators->k4;
+        const double step_dt = dt;
+        //c: c_hat = (c_hat - dt*M*k^2*mu_hat)/(1 + dt*M*KAPPA_C*k^4); eta_q: (eta_hat - dt*L*mu_hat)/(1 + dt*L*KAPPA_ETA*k^2)
+        spectral_parallel_for("timestep", k2, KOKKOS_LAMBDA(const int i, const int j) {
+            const double c_inverse = 1.0 / (1.0 + step_dt*p.mobility*p.kappa_c*k4(i, j));
+            hat[0](i, j) = static_cast<Scalar>(c_inverse)*hat[0](i, j)
+                - static_cast<Scalar>(step_dt*p.mobility*k2(i, j)*c_inverse)*hat[NumFields](i, j);
+            const Scalar eta_factor = 1.0 / (1.0 + step_dt*p.relaxation*p.kappa_eta*k2(i, j));
+            const Scalar potential_factor = -step_dt*p.relaxation*eta_factor;
+            for (std::size_t q=1; q<NumFields; q++)
+                hat[q](i, j) = eta_factor*hat[q](i, j) + potential_factor*hat[NumFields + q](i, j);
+        });
+        timers.stop("spectral_update");
+    }
+
+    void post_step() override {
+        const auto u = fields();
+        timers.start("fft_inverse");
+        vars.template fft_inverse_fused<NumFields>(0, KOKKOS_LAMBDA(const int i, const int j, Kokkos::Array<double, NumFields>& values) {
+            for (std::size_t v=0; v<NumFields; v++)
+                u[v](i, j, 0) = values[v];
+        });
+        timers.stop("fft_inverse");
+    }
+};
+
+//PFHub benchmark 2's initial conditions (from its 2a/2b variants), with NumOrderParameters (4 in the benchmark)
+template <std::size_t NumOrderParameters = 4, class Scalar = double>
+class PFHub2Benchmark final : public StaticTimestep<PFHub2Benchmark<NumOrderParameters, Scalar>, PFHub2Base<NumOrderParameters, Scalar>> {
+    using Static = StaticTimestep<PFHub2Benchmark<NumOrderParameters, Scalar>, PFHub2Base<NumOrderParameters, Scalar>>;
+public:
+    //c at the start, at position (x, y)
+    static KOKKOS_INLINE_FUNCTION double initial_c(const double x, const double y) {
+        const double square = Kokkos::cos(.13*x)*Kokkos::cos(.087*y);
+        return .5 + .05*(Kokkos::cos(.105*x)*Kokkos::cos(.11*y) + square*square
+            + Kokkos::cos(.025*x-.15*y)*Kokkos::cos(.07*x-.02*y));
+    }
+
+    //eta_q at the start, at position (x, y), for q from 1
+    static KOKKOS_INLINE_FUNCTION double initial_eta(const int q, const double x, const double y) {
+        const double ripple = Kokkos::cos((.046+.001*q)*x + (.0405+.001*q)*y)*Kokkos::cos((.031+.001*q)*x - (.004+.001*q)*y);
+        const double sum = Kokkos::cos(.01*q*x - 4)*Kokkos::cos((.007+.01*q)*y)
+            + Kokkos::cos((.11+.01*q)*x)*Kokkos::cos((.11+.01*q)*y) + 1.5*ripple*ripple;
+        return .1*sum*sum;
+    }
+
+    void initial_conditions() override {
+        const auto u = this->fields();  //get Views for scope capture
+        const auto delta = this->cell_size;
+        const auto offset = this->local_to_global();
+        const int x0 = offset[0], y0 = offset[1];
+        this->node_parallel_for("PFHub2 initial conditions", KOKKOS_LAMBDA(const int i, const int j) {
+            const double x = delta*(i + x0), y = delta*(j + y0);
+            u[0](i, j, 0) = initial_c(x, y);
+            for (std::size_t q=1; q<Static::NumFields; q++)
+                u[q](i, j, 0) = initial_eta(q, x, y);
+        });
+    }
+
+    //e.g. 2Benchmark_P4N256T1000
+    static std::string run_name_for(const int grid_points, const int timesteps) {
+        std::stringstream s;
+        s << "2Benchmark_P" << NumOrderParameters << "N" << grid_points << "T" << timesteps;
+        return s.str();
+    }
+
+    std::string run_name() const override {
+        return run_name_for(this->grid_points, this->timesteps);
+    }
+
+    PFHub2Benchmark(int grid_points, int timesteps, const PFHub2Parameters& parameters = PFHub2Parameters(),
+            MPI_Comm comm = MPI_COMM_WORLD, const Decomposition<2>& decomposition = Decomposition<2>())
+        : Static{grid_points, timesteps, parameters, comm, decomposition} {}
+};
+
+}
+
+#endif
@@ -2,7 +2,14 @@
 #define PFVARIABLES_H
 
 #include <Cajita.hpp>
+#include <Checkpoint.hpp>
+#include <FFT.hpp>
+#include <PlanCache.hpp>
+#include <ScratchArena.hpp>
+#include <Snapshot.hpp>
 #include <fstream>
+#include <optional>
+#include <vector>
 
 #ifdef RESULTS_PATH
 #include <filesystem>
@@ -10,62 +17,208 @@
 
 namespace CabanaPF {
 
-template <std::size_t NumSpaceDim, std::size_t NumVariables>
+/*The fields of a problem, and their spectra.  Scalar is the precision they are stored (and transformed) in.
+NumSpectra may be more than NumVariables: the extra spectra have no real space field, and are for quantities that
+are only ever computed while packing for an FFT (see fft_forward_fused), such as df_dc.  Leaving them out saves a
+full field of memory each, since the FFT's work buffer is the only real space storage they need, and it is shared.
+With NumSpectra = 0 there is no FFT at all, e.g. for stencil problems.*/
+template <std::size_t NumSpaceDim, std::size_t NumVariables, class Scalar = double, std::size_t NumSpectra = NumVariables>
 class PFVariables {
     using execution_space = Kokkos::DefaultExecutionSpace;
     using memory_space = typename execution_space::memory_space;
     using Mesh = Cajita::UniformMesh<double, NumSpaceDim>;
-    using CajitaArray = std::shared_ptr<Cajita::Array<double, Cajita::Node, Mesh, memory_space>>;
-    using View_type = std::conditional_t<3 == NumSpaceDim, Kokkos::View<double****, memory_space>, Kokkos::View<double***, memory_space>>;
+    using CajitaArray = std::shared_ptr<Cajita::Array<Scalar, Cajita::Node, Mesh, memory_space>>;
+    using View_type = std::conditional_t<3 == NumSpaceDim, Kokkos::View<Scalar****, memory_space>, Kokkos::View<Scalar***, memory_space>>;
+    using Spectrum_type = typename FFT<NumSpaceDim, Scalar>::Spectrum_type;
+    using Batch_type = typename FFT<NumSpaceDim, Scalar>::Batch_type;
 private:
     std::array<int, NumSpaceDim> array_size;    //number of x, y, (and possibly z) points
-    std::shared_ptr<Cajita::Experimental::HeffteFastFourierTransform<
-        Cajita::Node, Mesh, double, memory_space, execution_space, Cajita::Experimental::Impl::FFTBackendDefault>> fft_calculator;
+    std::shared_ptr<FFT<NumSpaceDim, Scalar>> fft_calculator;
+    Batch_type all_spectra;     //every variable's spectrum, one after another, so they can be batched
+    std::shared_ptr<Checkpoint<NumSpaceDim>> checkpointer;  //created on first use
+    std::optional<execution_space> side_space;  //for fft_forward_pipelined's packing, created on first use
+
+    Checkpoint<NumSpaceDim>& checkpoints() {
+        if (!checkpointer)
+            checkpointer = std::make_shared<Checkpoint<NumSpaceDim>>(*arrays[0]->layout());
+        return *checkpointer;
+    }
+
+    //Calls f(first, count) for each run of consecutive indices, which can be transformed as one batch
+    template <class RunFunctor>
+    void for_each_run(std::initializer_list<int> indices, RunFunctor f) {
+        auto it = indices.begin();
+        while (it != indices.end()) {
+            const int first = *it;
+            int count = 1;
+            for (it++; it != indices.end() && *it == first + count; it++)
+                count++;
+            f(first, count);
+        }
+    }
+
 public:
     std::array<CajitaArray, NumVariables> arrays;
+    std::array<Spectrum_type, NumSpectra> spectra;  //Fourier space values, filled in by fft_forward
 
-    PFVariables(std::shared_ptr<Cajita::ArrayLayout<Cajita::Node, Mesh>> layout, std::array<std::string, NumVariables> names) {
+    /*Real-valued fields (a layout with 1 dof) use real-to-complex FFTs, so their spectra only
+    hold the non-redundant half in x.  Complex fields (2 dofs) use complex-to-complex FFTs.*/
+
+    //arena: where the FFT's buffers come from (e.g. the runner's, to share them with its other temporaries).
+    //The FFT itself may be shared with other PFVariables on the same grid (see PlanCache).
+    PFVariables(std::shared_ptr<Cajita::ArrayLayout<Cajita::Node, Mesh>> layout, std::array<std::string, NumVariables> names,
+        const FFTOptions& fft_options = FFTOptions(), std::shared_ptr<ScratchArena> arena = nullptr)
+    {
         //create an array and store the name of each variable:
         for(std::size_t i=0; i<NumVariables; i++) {
-            arrays[i] = Cajita::createArray<double, memory_space>(names[i], layout);
+            arrays[i] = Cajita::createArray<Scalar, memory_space>(names[i], layout);
+        }
+        if constexpr (NumSpectra > 0) {
+            fft_calculator = PlanCache::fft<NumSpaceDim, Scalar>(*layout, NumSpectra, fft_options, arena);
+            all_spectra = fft_calculator->create_spectra("spectra", NumSpectra);
+            for(std::size_t i=0; i<NumSpectra; i++) {
+                if constexpr (NumSpaceDim == 3)
+                    spectra[i] = Kokkos::subview(all_spectra, Kokkos::ALL(), Kokkos::ALL(), Kokkos::ALL(), i);
+                else
+                    spectra[i] = Kokkos::subview(all_spectra, Kokkos::ALL(), Kokkos::ALL(), i);
+            }
         }
         //Record the array size for each spatial dimension:
         const auto GlobalMesh = layout->localGrid()->globalGrid().globalMesh();
         for(std::size_t i=0; i<NumSpaceDim; i++) {
             array_size[i] = GlobalMesh.globalNumCell(i);
         }
-        fft_calculator = Cajita::Experimental::createHeffteFastFourierTransform<double, memory_space>(*layout);
     }
 
     void fft_forward(int index) {
-        fft_calculator->forward(*arrays[index], Cajita::Experimental::FFTScaleNone());
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_forward");
+        fft_calculator->forward(*arrays[index], spectra[index]);
+        Kokkos::Profiling::popRegion();
     }
 
     void fft_inverse(int index) {
-        fft_calculator->reverse(*arrays[index], Cajita::Experimental::FFTScaleFull());
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_inverse");
+        fft_calculator->reverse(spectra[index], *arrays[index]);
+        Kokkos::Profiling::popRegion();
+    }
+
+    /*Transform several variables at once.  Consecutive indices (e.g. {0, 1}) go through a single batched
+    heFFTe transform, so they share one set of reshapes instead of communicating once per variable.*/
+    void fft_forward(std::initializer_list<int> indices) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_forward");
+        for_each_run(indices, [&](const int first, const int count) {
+            for (int v=0; v<count; v++)
+                fft_calculator->pack(arrays[first+v]->view(), v);
+            fft_calculator->forward_packed(count, spectra[first].data());
+        });
+        Kokkos::Profiling::popRegion();
+    }
+
+    void fft_inverse(std::initializer_list<int> indices) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_inverse");
+        for_each_run(indices, [&](const int first, const int count) {
+            fft_calculator->reverse_packed(count, spectra[first].data());
+            for (int v=0; v<count; v++)
+                fft_calculator->unpack(arrays[first+v]->view(), v);
+        });
+        Kokkos::Profiling::popRegion();
+    }
+
+    /*Fused versions of the above, for real fields: rather than copying stored fields in and out of the FFT,
+    a functor computes the real space values while they are packed (or is handed them while unpacking).
+    This skips a separate sweep over memory, e.g. for nonlinear terms that only exist to be transformed.
+    The Count spectra starting at first are used.  See FFT::pack_function for the functor's signature.*/
+    template <int Count, class Functor>
+    void fft_forward_fused(const int first, const Functor& f) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_forward");
+        fft_calculator->template pack_function<Count>(f);
+        fft_calculator->forward_packed(Count, spectra[first].data());
+        Kokkos::Profiling::popRegion();
+    }
+
+    /*Like fft_forward_fused<1 + TailCount>, but pipelined: head packs spectrum first's values, which are transformed
+    on their own, while tail packs the next TailCount on a second execution space instance, to be transformed as a
+    batch once that is done.  So tail's pointwise work (e.g. a nonlinear term) overlaps the first transform's
+    reshapes, at the cost of a second set of them.  On GPUs, where kernels run alongside heFFTe's blocking MPI, that
+    can hide much of the communication; on CPUs the kernels aren't asynchronous, so it only costs.  Fences first.*/
+    template <int TailCount, class HeadFunctor, class TailFunctor>
+    void fft_forward_pipelined(const int first, const HeadFunctor& head, const TailFunctor& tail) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_forward_pipelined");
+        if (!side_space)
+            side_space = Kokkos::Experimental::partition_space(execution_space(), 1)[0];
+        execution_space().fence();      //tail may read what the default instance just wrote
+        fft_calculator->template pack_function<TailCount>(tail, 1, *side_space);
+        fft_calculator->template pack_function<1>(head, 0);
+        fft_calculator->forward_packed(1, spectra[first].data(), 0);
+        side_space->fence();
+        fft_calculator->forward_packed(TailCount, spectra[first+1].data(), 1);
+        Kokkos::Profiling::popRegion();
+    }
+
+    template <int Count, class Functor>
+    void fft_inverse_fused(const int first, const Functor& f) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_inverse");
+        fft_calculator->reverse_packed(Count, spectra[first].data());
+        fft_calculator->template unpack_function<Count>(f);
+        Kokkos::Profiling::popRegion();
+    }
+
+    void fft_forward_all() {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::fft_forward");
+        for (std::size_t v=0; v<NumVariables; v++)
+            fft_calculator->pack(arrays[v]->view(), v);
+        fft_calculator->forward_packed(NumVariables, all_spectra.data());
+        Kokkos::Profiling::popRegion();
     }
 
     View_type operator[](int index) {
         return arrays[index]->view();
     }
 
+    //Fourier space values of a variable (only meaningful after fft_forward)
+    Spectrum_type spectrum(int index) {
+        return spectra[index];
+    }
+
+    //The heFFTe plan in use (e.g. after autotuning)
+    std::string fft_plan() const {
+        return fft_calculator->plan_description();
+    }
+
+    //Global index of this rank's first Fourier space point, in each dimension
+    std::array<int, NumSpaceDim> spectrum_offset() const {
+        return fft_calculator->spectrum_offset();
+    }
+
+    std::array<int, NumSpaceDim> spectrum_extent() const {
+        return fft_calculator->spectrum_extent();
+    }
+
     /*If on GPU, will copy over the data to CPU and return it
     If on CPU, same as using []*/
     auto host_view(int index) {
         return Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), arrays[index]->view());
     }
 
-    std::string save_name(std::string run_name, [[maybe_unused]]  const int index, [[maybe_unused]] const int timesteps_done = -1) {
+    //e.g. 1aBenchmark_N96T500_c.dat, or with timesteps_done, 1aBenchmark_N96T500_c_250.dat
+    std::string save_name(std::string run_name, const int index, const int timesteps_done = -1) {
+        return base_name(run_name, index, timesteps_done) + ".dat";
+    }
+
+    std::string base_name(std::string run_name, const int index, const int timesteps_done = -1) {
         std::stringstream name;
         #ifdef RESULTS_PATH
         name << RESULTS_PATH;
         #endif
-        name << run_name << "_" << arrays[index]->label() << ".dat";
+        name << run_name << "_" << arrays[index]->label();
+        if (timesteps_done >= 0)
+            name << "_" << timesteps_done;
         return name.str();
     }
 
     //If unfinished and just saving progress, pass in timesteps_done
     void save(const int index, [[maybe_unused]] std::string run_name, [[maybe_unused]] const int timesteps_done = -1) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::save");
         Cajita::Experimental::BovWriter::writeTimeStep(999999, 0, *arrays[index]);  //use 999999 to mark it for move
         #ifdef RESULTS_PATH  //Comes from the CMake build; if not defined, won't have file I/O
         try {
@@ -76,26 +229,92 @@ public:
             std::cerr << "Error when saving: " << e.what() << std::endl;
         }
         #endif
+        Kokkos::Profiling::popRegion();
+    }
+
+    /*Write a variable at this point in the run, optionally cut down to a region and/or every stride-th node, and
+    stored in reduced precision, on the device first (see Snapshot.hpp).  Unlike save, there is no duplicated periodic
+    seam.  Files are named as in save_name, so each timestep gets its own.*/
+    void snapshot(const int index, std::string run_name, const int timesteps_done, const double time,
+        const SnapshotRegion<NumSpaceDim>& region = SnapshotRegion<NumSpaceDim>(), const SnapshotFormat& format = SnapshotFormat())
+    {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::snapshot");
+        SnapshotWriter<NumSpaceDim> writer(*arrays[index]->layout(), region, format);
+        writer.write(base_name(run_name, index, timesteps_done), *arrays[index], time);
+        Kokkos::Profiling::popRegion();
     }
 
     void load(std::string run_name, const int timesteps_done = -1) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::load");
         for (std::size_t index=0; index<NumVariables; index++) {
-            assert(NumSpaceDim==2);    //currently not supported for 3D
             //open the file:
             std::fstream infile(save_name(run_name, index, timesteps_done), std::fstream::in|std::fstream::binary);
-            //read it:
-            const auto view = arrays[index]->view();
-            double buffer[2];
-            for (int j=0; j<array_size[1]; j++) {
-                for (int i=0; i<array_size[0]; i++) {
-                    infile.read((char*)buffer, 2*sizeof(double));
-                    view(i, j, 0) = buffer[0];
-                    view(i, j, 1) = buffer[1];
+            //read it a row at a time into a host copy of the owned nodes, then copy that over all at once:
+            const auto view = Kokkos::create_mirror_view(Kokkos::HostSpace(), arrays[index]->view());
+            const auto& global_grid = arrays[index]->layout()->localGrid()->globalGrid();
+            const auto own_space = arrays[index]->layout()->localGrid()->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local());
+            const int x0 = global_grid.globalOffset(0), y0 = global_grid.globalOffset(1);
+            const int z0 = NumSpaceDim == 3 ? global_grid.globalOffset(NumSpaceDim-1) : 0;
+            const int owned_z = NumSpaceDim == 3 ? own_space.extent(NumSpaceDim-1) : 1;
+            const int dofs = arrays[index]->layout()->dofsPerEntity();
+            /*since the grid is periodic, it writes the first value in each row again at the end, which is skipped.
+            In 3D, each plane also ends with its first row again, and the file with its first plane, which are skipped too.*/
+            std::vector<Scalar> row(dofs*(array_size[0]+1));    //save writes the values as they are stored
+            const int planes = NumSpaceDim == 3 ? array_size[NumSpaceDim-1] : 1;
+            const int rows = NumSpaceDim == 3 ? array_size[1]+1 : array_size[1];
+            for (int k=0; k<planes; k++) {
+                for (int j=0; j<rows; j++) {
+                    infile.read((char*)row.data(), row.size()*sizeof(Scalar));
+                    if (j < y0 || j >= y0 + static_cast<int>(own_space.extent(1)) || k < z0 || k >= z0 + owned_z)
+                        continue;
+                    for (int i=x0; i<x0 + static_cast<int>(own_space.extent(0)); i++) {
+                        for (int d=0; d<dofs; d++) {
+                            if constexpr (NumSpaceDim == 3)
+                                view(own_space.min(0) + i-x0, own_space.min(1) + j-y0, own_space.min(2) + k-z0, d) = row[dofs*i+d];
+                            else
+                                view(own_space.min(0) + i-x0, own_space.min(1) + j-y0, d) = row[dofs*i+d];
+                        }
+                    }
                 }
-                //since the grid is periodic, it writes the first value in the row again, so "burn it off":
-                infile.read((char*)buffer, 2*sizeof(double));
             }
+            Kokkos::deep_copy(arrays[index]->view(), view);
         }
+        Kokkos::Profiling::popRegion();
+    }
+
+    std::string checkpoint_name(std::string run_name, const int timesteps_done) {
+        std::stringstream name;
+        #ifdef RESULTS_PATH
+        name << RESULTS_PATH;
+        #endif
+        name << run_name << "_checkpoint_" << timesteps_done << ".cpf";
+        return name.str();
+    }
+
+    /*Write every variable and the restart info to one file with collective MPI-IO (see Checkpoint.hpp).
+    Unlike save, this is meant for restarting large runs: it writes each rank's block in place, and works from GPU memory.
+    With async, only a device snapshot is taken before returning, and the file is written in the background
+    while the run continues; call wait_for_output() before depending on the file.*/
+    void checkpoint(std::string run_name, const CheckpointInfo& info, const bool async = false) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::checkpoint");
+        if (async)
+            checkpoints().write_async(checkpoint_name(run_name, info.timesteps_done), arrays, info);
+        else
+            checkpoints().write(checkpoint_name(run_name, info.timesteps_done), arrays, info);
+        Kokkos::Profiling::popRegion();
+    }
+
+    void wait_for_output() {
+        if (checkpointer)
+            checkpointer->wait();
+    }
+
+    //Read back every variable from checkpoint(), which may have been written by a different number of ranks
+    CheckpointInfo restart(std::string run_name, const int timesteps_done) {
+        Kokkos::Profiling::pushRegion("CabanaPF::PFVariables::restart");
+        const auto info = checkpoints().read(checkpoint_name(run_name, timesteps_done), arrays);
+        Kokkos::Profiling::popRegion();
+        return info;
     }
 };
 
@@ -0,0 +1,111 @@
+#ifndef PHASETIMERS_H
+#define PHASETIMERS_H
+
+#include <Kokkos_Core.hpp>
+#include <mpi.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace CabanaPF {
+
+/*Accumulated wall-clock time for each named phase of a run (pre_step, fft_forward, ...).  Each start/stop fences,
+so that on GPUs kernel execution rather than launch time is measured.  Timing is off (and free) until enabled.
+Every phase is also a Kokkos Tools region ("CabanaPF::<phase>"), whether or not timing is enabled.*/
+class PhaseTimers {
+    using clock = std::chrono::steady_clock;
+
+    bool enabled;
+    std::vector<std::string> names;     //in the order they were first started
+    std::vector<double> totals;         //seconds
+    std::vector<long> calls;
+    std::vector<clock::time_point> starts;
+
+    int find(const std::string_view name) {
+        const auto it = std::find(names.begin(), names.end(), name);
+        if (it != names.end())
+            return it - names.begin();
+        names.emplace_back(name);
+        totals.push_back(0);
+        calls.push_back(0);
+        starts.push_back(clock::time_point());
+        return names.size() - 1;
+    }
+
+public:
+    PhaseTimers() : enabled{false} {}
+
+    void enable(const bool value) {
+        enabled = value;
+    }
+
+    bool is_enabled() const {
+        return enabled;
+    }
+
+    //Names are views, so literals build no string unless timing or a Kokkos tool needs one
+    void start(const std::string_view name) {
+        if (Kokkos::Profiling::profileLibraryLoaded())
+            Kokkos::Profiling::pushRegion("CabanaPF::" + std::string(name));
+        if (!enabled)
+            return;
+        Kokkos::fence();
+        starts[find(name)] = clock::now();
+    }
+
+    void stop(const std::string_view name) {
+        if (enabled) {
+            Kokkos::fence();
+            const int phase = find(name);
+            totals[phase] += std::chrono::duration<double>(clock::now() - starts[phase]).count();
+            calls[phase]++;
+        }
+        if (Kokkos::Profiling::profileLibraryLoaded())
+            Kokkos::Profiling::popRegion();
+    }
+
+    const std::vector<std::string>& phases() const {
+        return names;
+    }
+
+    //Total seconds spent in a phase on this rank (0 if it never ran)
+    double total(const std::string_view name) const {
+        const auto it = std::find(names.begin(), names.end(), name);
+        return it == names.end() ? 0 : totals[it - names.begin()];
+    }
+
+    long count(const std::string_view name) const {
+        const auto it = std::find(names.begin(), names.end(), name);
+        return it == names.end() ? 0 : calls[it - names.begin()];
+    }
+
+    void reset() {
+        names.clear();
+        totals.clear();
+        calls.clear();
+        starts.clear();
+    }
+
+    /*Write the total and per-call time of each phase, from the slowest rank, on rank 0.  This is collective
+    over comm, so every rank must have run the same phases.*/
+    void report(std::ostream& stream, MPI_Comm comm) const {
+        int comm_rank;
+        MPI_Comm_rank(comm, &comm_rank);
+        if (0 == comm_rank)
+            stream << "phase total(s) calls per_call(us)\n";
+        for (std::size_t p=0; p<names.size(); p++) {
+            double slowest = 0;
+            MPI_Reduce(&totals[p], &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+            if (0 == comm_rank)
+                stream << names[p] << " " << slowest << " " << calls[p] << " " << 1e6*slowest/std::max(calls[p], 1L) << "\n";
+        }
+    }
+};
+
+}
+
+#endif
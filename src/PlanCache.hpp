@@ -0,0 +1,250 @@
+#ifndef PLANCACHE_H
+#define PLANCACHE_H
+
+#include <Cajita.hpp>
+#include <FFT.hpp>
+#include <ScratchArena.hpp>
+#include <SpectralOperators.hpp>
+#include <mpi.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace CabanaPF {
+
+/*Process-wide reuse of the setup that only depends on the grid: the local grid and its layouts, heFFTe plans (autotuned
+ones included), the spectral operators, and the scratch arena, so that sweeps which construct many simulations of the
+same size (repeats, timestep counts) only plan once.  Entries are keyed on the grid size, domain size, rank grid, halo
+width, and communicator (any congruent one matches), and for plans on the precision, batch size, and FFTOptions as
+well; the backend is fixed by the build.  Cached objects are shared by every simulation using them, which is safe since
+their state only lasts within a transform, and simulations take their timesteps one at a time.
+
+Off by default.  Once enabled, entries stay until clear(), which Kokkos::finalize() calls, so nothing outlives Kokkos
+or MPI (as long as MPI is finalized after Kokkos).  When the cache is off, each function just builds a new object.*/
+class PlanCache {
+    using memory_space = Kokkos::DefaultExecutionSpace::memory_space;
+
+    template <std::size_t NumSpaceDim>
+    using LocalGrid_ptr = std::shared_ptr<Cajita::LocalGrid<Cajita::UniformMesh<double, NumSpaceDim>>>;
+    template <std::size_t NumSpaceDim>
+    using Layout_ptr = std::shared_ptr<Cajita::ArrayLayout<Cajita::Node, Cajita::UniformMesh<double, NumSpaceDim>>>;
+
+    template <std::size_t NumSpaceDim>
+    struct GridEntry {
+        std::shared_ptr<MPI_Comm> comm;     //a duplicate, so the handle can't be freed and reused while cached
+        int points;
+        double size;
+        std::array<int, NumSpaceDim> ranks_per_dim;
+        int halo_width;
+        LocalGrid_ptr<NumSpaceDim> local_grid;
+    };
+
+    template <std::size_t NumSpaceDim>
+    struct LayoutEntry {
+        const void* grid;
+        int dofs;
+        Layout_ptr<NumSpaceDim> layout;
+    };
+
+    template <std::size_t NumSpaceDim, class Scalar>
+    struct FFTEntry {
+        const void* grid;
+        int dofs;
+        int max_batch;
+        FFTOptions options;
+        std::shared_ptr<FFT<NumSpaceDim, Scalar>> fft;
+        LocalGrid_ptr<NumSpaceDim> local_grid;      //keeps grid from being reused by another local grid
+    };
+
+    template <std::size_t NumSpaceDim>
+    struct OperatorEntry {
+        std::array<int, NumSpaceDim> offset;
+        std::array<int, NumSpaceDim> extent;
+        int points;
+        double size;
+        std::shared_ptr<SpectralOperators<NumSpaceDim>> operators;
+    };
+
+    struct ArenaEntry {
+        const void* grid;
+        std::shared_ptr<ScratchArena> arena;
+        std::shared_ptr<const void> local_grid;
+    };
+
+    static bool& is_enabled() {
+        static bool enabled = false;
+        return enabled;
+    }
+
+    static long& hit_count() {
+        static long hits = 0;
+        return hits;
+    }
+
+    static long& miss_count() {
+        static long misses = 0;
+        return misses;
+    }
+
+    static std::vector<std::function<void()>>& clearers() {
+        static std::vector<std::function<void()>> all;
+        return all;
+    }
+
+    //The entries of one kind, which clear() empties along with the rest
+    template <class Entry>
+    static std::vector<Entry>& entries() {
+        static std::vector<Entry> stored;
+        static const bool registered = [] {
+            clearers().push_back([] { stored.clear(); });
+            return true;
+        }();
+        (void) registered;
+        return stored;
+    }
+
+    static bool same_options(const FFTOptions& a, const FFTOptions& b) {
+        return a.use_reorder == b.use_reorder && a.use_pencils == b.use_pencils && a.algorithm == b.algorithm
+            && a.use_gpu_aware == b.use_gpu_aware && a.autotune == b.autotune;
+    }
+
+    //The cached object of the first matching entry (counting a hit), or a new one from build (counting a miss)
+    template <class Entry, class Object, class Matches, class Build>
+    static Object lookup(Object Entry::* member, const Matches& matches, const Build& build) {
+        for (const auto& entry : entries<Entry>()) {
+            if (matches(entry)) {
+                hit_count()++;
+                return entry.*member;
+            }
+        }
+        miss_count()++;
+        return build();
+    }
+
+public:
+    //Turn the cache on or off; turning it off keeps what is cached until clear()
+    static void enable(const bool value) {
+        static bool hooked = false;
+        if (value && !hooked) {
+            Kokkos::push_finalize_hook([] { clear(); });
+            hooked = true;
+        }
+        is_enabled() = value;
+    }
+
+    static bool enabled() {
+        return is_enabled();
+    }
+
+    //Drop every entry (the objects themselves go once no simulation is using them)
+    static void clear() {
+        for (const auto& clearer : clearers())
+            clearer();
+    }
+
+    //How many lookups found an entry, and how many had to build one, since the start
+    static long hits() {
+        return hit_count();
+    }
+
+    static long misses() {
+        return miss_count();
+    }
+
+    //The local grid of a periodic grid_points^N grid of the given size on comm, from build() if it isn't cached
+    template <std::size_t NumSpaceDim, class Build>
+    static LocalGrid_ptr<NumSpaceDim> local_grid(MPI_Comm comm, const int points, const double size,
+        const std::array<int, NumSpaceDim>& ranks_per_dim, const int halo_width, const Build& build)
+    {
+        if (!enabled())
+            return build();
+        using Entry = GridEntry<NumSpaceDim>;
+        return lookup(&Entry::local_grid, [&](const Entry& entry) {
+            if (entry.points != points || entry.size != size || entry.ranks_per_dim != ranks_per_dim
+                    || entry.halo_width != halo_width)
+                return false;
+            int result;
+            MPI_Comm_compare(*entry.comm, comm, &result);
+            return result == MPI_IDENT || result == MPI_CONGRUENT;
+        }, [&]() {
+            auto duplicate = std::shared_ptr<MPI_Comm>(new MPI_Comm, [](MPI_Comm* c) {
+                MPI_Comm_free(c);
+                delete c;
+            });
+            MPI_Comm_dup(comm, duplicate.get());
+            auto built = build();
+            entries<Entry>().push_back({duplicate, points, size, ranks_per_dim, halo_width, built});
+            return built;
+        });
+    }
+
+    template <std::size_t NumSpaceDim>
+    static Layout_ptr<NumSpaceDim> layout(const LocalGrid_ptr<NumSpaceDim>& local_grid, const int dofs) {
+        if (!enabled())
+            return Cajita::createArrayLayout(local_grid, dofs, Cajita::Node());
+        using Entry = LayoutEntry<NumSpaceDim>;
+        return lookup(&Entry::layout, [&](const Entry& entry) {
+            return entry.grid == local_grid.get() && entry.dofs == dofs;
+        }, [&]() {
+            auto built = Cajita::createArrayLayout(local_grid, dofs, Cajita::Node());
+            entries<Entry>().push_back({local_grid.get(), dofs, built});
+            return built;
+        });
+    }
+
+    //An FFT of layout's grid and dofs (see FFT's constructor); a new one uses arena for its buffers
+    template <std::size_t NumSpaceDim, class Scalar = double>
+    static std::shared_ptr<FFT<NumSpaceDim, Scalar>> fft(const Cajita::ArrayLayout<Cajita::Node, Cajita::UniformMesh<double, NumSpaceDim>>& layout,
+        const int max_batch, const FFTOptions& options, std::shared_ptr<ScratchArena> arena)
+    {
+        if (!enabled())
+            return std::make_shared<FFT<NumSpaceDim, Scalar>>(layout, max_batch, options, arena);
+        using Entry = FFTEntry<NumSpaceDim, Scalar>;
+        const auto local_grid = layout.localGrid();
+        const int dofs = layout.dofsPerEntity();
+        return lookup(&Entry::fft, [&](const Entry& entry) {
+            return entry.grid == local_grid.get() && entry.dofs == dofs && entry.max_batch == max_batch
+                && same_options(entry.options, options);
+        }, [&]() {
+            auto built = std::make_shared<FFT<NumSpaceDim, Scalar>>(layout, max_batch, options, arena);
+            entries<Entry>().push_back({local_grid.get(), dofs, max_batch, options, built, local_grid});
+            return built;
+        });
+    }
+
+    //The spectral operators of a block of Fourier space (see SpectralOperators' constructor)
+    template <std::size_t NumSpaceDim>
+    static std::shared_ptr<SpectralOperators<NumSpaceDim>> operators(const std::array<int, NumSpaceDim>& offset,
+        const std::array<int, NumSpaceDim>& extent, const int points, const double size)
+    {
+        if (!enabled())
+            return std::make_shared<SpectralOperators<NumSpaceDim>>(offset, extent, points, size);
+        using Entry = OperatorEntry<NumSpaceDim>;
+        return lookup(&Entry::operators, [&](const Entry& entry) {
+            return entry.offset == offset && entry.extent == extent && entry.points == points && entry.size == size;
+        }, [&]() {
+            auto built = std::make_shared<SpectralOperators<NumSpaceDim>>(offset, extent, points, size);
+            entries<Entry>().push_back({offset, extent, points, size, built});
+            return built;
+        });
+    }
+
+    //The scratch arena for simulations on local_grid, so cached FFTs and their temporaries share one
+    template <class LocalGrid_t>
+    static std::shared_ptr<ScratchArena> arena(const std::shared_ptr<LocalGrid_t>& local_grid) {
+        if (!enabled())
+            return std::make_shared<ScratchArena>();
+        return lookup(&ArenaEntry::arena, [&](const ArenaEntry& entry) {
+            return entry.grid == local_grid.get();
+        }, [&]() {
+            auto built = std::make_shared<ScratchArena>();
+            entries<ArenaEntry>().push_back({local_grid.get(), built, local_grid});
+            return built;
+        });
+    }
+};
+
+}
+
+#endif
@@ -2,9 +2,52 @@
 #define RUNNER_H
 
 #include <Cajita.hpp>
+#include <DeviceBinding.hpp>
+#include <FFT.hpp>
+#include <KernelTuning.hpp>
+#include <PhaseTimers.hpp>
+#include <PlanCache.hpp>
+#include <ScratchArena.hpp>
+#include <StepGraph.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <type_traits>
+#include <vector>
 
 namespace CabanaPF {
 
+//How a run is split over its ranks.  The defaults let Cajita pick the rank grid and use heFFTe's default plan.
+template <std::size_t NumSpaceDim>
+struct Decomposition {
+    std::array<int, NumSpaceDim> ranks_per_dim{};   //e.g. {P, 1} for slabs in 2D; all zeros lets MPI_Dims_create choose
+    FFTOptions fft;
+};
+
+//Global quantities a problem reports on diagnostic timesteps (see set_diagnostic_interval), all of the state after the timestep
+struct Diagnostics {
+    int timestep = -1;  //timesteps done when these were computed (-1 if never)
+    double time = 0;
+    double free_energy = 0;
+    double mass = 0;        //integral of the order parameter
+    double l2_norm = 0;     //of the order parameter
+    double l2_change = 0;   //of its change over the timestep
+};
+
+/*When a run counts as having reached steady state, checked on each diagnostic timestep.  Either test ends the run
+early, if its threshold is positive (0 disables it); see set_convergence.*/
+struct ConvergenceCriterion {
+    double relative_change = 0;     //l2_change/l2_norm of a single timestep below this
+    double energy_change = 0;       //relative free energy decrease over the last window diagnostics below this
+    int window = 1;
+    int interval = 100;             //diagnostic interval to use, if diagnostics aren't already on
+};
+
 //Inherit from this to implement the problem's specific actions
 template <std::size_t NumSpaceDim>
 class CabanaPFRunner {
@@ -17,57 +60,397 @@ protected:
     std::shared_ptr<Cajita::ArrayLayout<Cajita::Node, Mesh>> layout;
     int timesteps_done;
     bool have_initialized;
+    bool fused;     //call fused_step() instead of pre_step(), step(), and post_step()
+    PhaseTimers timers;     //problems can time their own sub-phases (fft_forward, io, ...) with these
+    std::shared_ptr<ScratchArena> arena;    //temporaries, and the FFT buffers of the problem's PFVariables
+    const Decomposition<NumSpaceDim> decomposition;     //problems pass decomposition.fft on to their PFVariables
+    KernelTuning<NumSpaceDim> tuning;   //how node_parallel_for and spectral_parallel_for launch their kernels
+
+    //throughput counters, updated every counter_interval timesteps (0 to disable)
+    int counter_interval;
+    int counter_start_step;
+    std::chrono::steady_clock::time_point counter_start;
+    double steps_per_second;
+
+    //output schedule: snapshot() is called every output_interval timesteps (0 to disable), and at each output time
+    int output_interval;
+    std::vector<double> output_times;   //sorted
+    std::size_t next_output_time;
+
+    //diagnostics: computed every diagnostic_interval timesteps (0 to disable), and written to std::cout if logged
+    int diagnostic_interval;
+    bool log_diagnostics;
+    Diagnostics latest_diagnostics;
+
+    //Whether the timestep being taken should compute diagnostics, for problems to check from their phases
+    bool diagnostics_due() const {
+        return diagnostic_interval > 0 && (timesteps_done+1) % diagnostic_interval == 0;
+    }
+
+    //early termination
+    std::optional<ConvergenceCriterion> convergence;
+    std::deque<double> recent_energies;     //the last window+1 free energies
+    bool converged;
+    bool finalized;     //finalize() has been called, so the run is over
+
+    //graph replay of timesteps (see set_graph_capture)
+    bool use_graphs;
+    bool graph_warmed_up;   //a timestep has been taken normally since the graph was last reset
+    StepGraph step_graph;
+    std::vector<ScratchArena::Lease> graph_leases;  //the scratch memory the graph replays into, held until it is reset
+
+    void check_convergence(const Diagnostics& diagnostics) {
+        if (convergence->relative_change > 0 && diagnostics.l2_norm > 0
+                && diagnostics.l2_change / diagnostics.l2_norm < convergence->relative_change)
+            converged = true;
+        if (convergence->energy_change <= 0)
+            return;
+        recent_energies.push_back(diagnostics.free_energy);
+        if (static_cast<int>(recent_energies.size()) > convergence->window + 1)
+            recent_energies.pop_front();
+        if (static_cast<int>(recent_energies.size()) == convergence->window + 1) {
+            const double decrease = recent_energies.front() - recent_energies.back();
+            if (decrease < convergence->energy_change * std::abs(recent_energies.back()))
+                converged = true;
+        }
+    }
+
+    //Problems call this once they have the (global) diagnostics for the timestep being taken
+    void report_diagnostics(const Diagnostics& diagnostics) {
+        latest_diagnostics = diagnostics;
+        if (convergence)
+            check_convergence(diagnostics);
+        int rank;
+        MPI_Comm_rank(comm(), &rank);
+        if (log_diagnostics && 0 == rank)
+            std::cout << "step " << diagnostics.timestep << " time " << diagnostics.time << " free_energy "
+                << diagnostics.free_energy << " mass " << diagnostics.mass << " l2_change " << diagnostics.l2_change << std::endl;
+    }
+
+    bool output_due() {
+        bool due = output_interval > 0 && timesteps_done % output_interval == 0;
+        const double now = simulation_time();
+        //the tolerance keeps rounding in timesteps_done*dt from pushing an output to the next timestep
+        while (next_output_time < output_times.size() && now >= output_times[next_output_time] - 1e-9*std::max(1.0, now)) {
+            due = true;
+            next_output_time++;
+        }
+        return due;
+    }
+
+    void update_counters() {
+        Kokkos::fence();
+        const auto now = std::chrono::steady_clock::now();
+        const double elapsed = std::chrono::duration<double>(now - counter_start).count();
+        steps_per_second = (timesteps_done - counter_start_step) / elapsed;
+        counter_start = now;
+        counter_start_step = timesteps_done;
+        if (Kokkos::Profiling::profileLibraryLoaded()) {
+            std::stringstream event;
+            event << "CabanaPF: step " << timesteps_done << ", " << steps_per_second << " timesteps/s, "
+                << points_per_second() << " points/s";
+            Kokkos::Profiling::markEvent(event.str());
+        }
+    }
+
+    //Run f as a named phase, timing it only if phase timing (or a Kokkos tool) is on, so no labels are built otherwise
+    template <class Function>
+    void phase(const char* name, const bool timed, Function&& f) {
+        if (!timed) {
+            f();
+            return;
+        }
+        timers.start(name);
+        f();
+        timers.stop(name);
+    }
+
+    template <class Problem>
+    void take_step(Problem& problem, const bool timed) {
+        if (fused) {
+            phase("fused_step", timed, [&]() { problem.fused_step(); });
+        } else {
+            phase("pre_step", timed, [&]() { problem.pre_step(); });
+            phase("step", timed, [&]() { problem.step(); });
+            phase("post_step", timed, [&]() { problem.post_step(); });
+        }
+    }
+
+    //Take the timestep by launching the captured graph, capturing it first if need be; false if it must be taken normally
+    template <class Problem>
+    bool replay_step(Problem& problem) {
+        if (!step_graph.captured()) {
+            //one timestep is taken normally first, so whatever the step allocates or builds on first use already exists
+            if (!graph_warmed_up) {
+                graph_warmed_up = true;
+                return false;
+            }
+            bool captured = false;
+            graph_leases = arena->retain([&]() { captured = step_graph.capture([&]() { take_step(problem, false); }); });
+            if (!captured) {
+                graph_leases.clear();
+                use_graphs = false;     //this step can't be captured here, so stop trying
+                return false;
+            }
+        }
+        step_graph.launch();
+        return true;
+    }
+
+    //Problems call this when their timestep's device work changes (different kernels or Views), so it is captured again
+    void reset_graph() {
+        step_graph.reset();
+        graph_leases.clear();
+        graph_warmed_up = false;
+    }
+
+    /*The timestep loop.  The phases are called on problem as a Problem, so when Problem is the problem's (final) class
+    they are bound at compile time and can be inlined; see StaticTimestep.  timestep() uses CabanaPFRunner, with
+    the usual virtual calls.*/
+    template <class Problem>
+    void run(Problem& problem, int count) {
+        if (finalized) {
+            int rank;
+            MPI_Comm_rank(comm(), &rank);
+            if (count > 0 && 0 == rank)
+                std::cerr << "CabanaPF: the run is over (" << (converged ? "converged" : "finished") << " after "
+                    << timesteps_done << " timesteps), so " << count << " more were not taken" << std::endl;
+            return;
+        }
+        const bool timed = timers.is_enabled() || Kokkos::Profiling::profileLibraryLoaded();
+        if (!have_initialized) {
+            phase("initialize", timed, [&]() { problem.initialize(); });
+            have_initialized = true;
+        }
+        for(int i=0; i<count && !problem.finished(); i++) {
+            //graphs leave out the phase timing and run no host code, so they can't be used when either is needed
+            const bool replayed = use_graphs && !timed && !diagnostics_due() && problem.capturable() && replay_step(problem);
+            if (!replayed)
+                take_step(problem, timed);
+            timesteps_done++;
+            if (counter_interval > 0 && (timesteps_done - counter_start_step) % counter_interval == 0)
+                update_counters();
+            if (output_due())
+                phase("snapshot", timed, [&]() { problem.snapshot(); });
+            if (converged)
+                break;
+        }
+        if (problem.finished() || converged) {
+            finalized = true;
+            problem.finalize();
+        }
+    }
+
 public:
     const int grid_points;
     const int timesteps;
 
-    CabanaPFRunner(int grid_points, int timesteps, double size)
-        : timesteps_done{0}, have_initialized{false}, grid_points{grid_points}, timesteps{timesteps}
+    //dofs: 1 for real-valued fields (real-to-complex FFTs), 2 for complex fields (real & imag)
+    //comm: the ranks this simulation runs on (e.g. a sub-communicator for scaling studies)
+    //halo_width: ghost nodes around each rank's block, for stencils (spectral problems need none)
+    CabanaPFRunner(int grid_points, int timesteps, double size, int dofs = 1, MPI_Comm comm = MPI_COMM_WORLD,
+            const Decomposition<NumSpaceDim>& decomposition = Decomposition<NumSpaceDim>(), const int halo_width = 0)
+        : timesteps_done{0}, have_initialized{false}, fused{false}, decomposition{decomposition},
+        counter_interval{0}, counter_start_step{0}, steps_per_second{0}, output_interval{0}, next_output_time{0},
+        diagnostic_interval{0}, log_diagnostics{false}, converged{false}, finalized{false}, use_graphs{false}, graph_warmed_up{false},
+        grid_points{grid_points}, timesteps{timesteps}
+    {
+        check_device_binding();
+        //the grid, its layout, and the arena only depend on the sizes, so may come from the PlanCache
+        local_grid = PlanCache::local_grid<NumSpaceDim>(comm, grid_points, size, decomposition.ranks_per_dim, halo_width, [&]() {
+            std::array<double, NumSpaceDim> low_corner;
+            low_corner.fill(0.0);
+            std::array<double, NumSpaceDim> high_corner;
+            high_corner.fill(size);
+            std::array<int, NumSpaceDim> num_cell;
+            num_cell.fill(grid_points);
+            auto global_mesh = Cajita::createUniformGlobalMesh(
+                low_corner, high_corner, num_cell
+            );
+            std::shared_ptr<Cajita::BlockPartitioner<NumSpaceDim>> partitioner;
+            const auto& ranks = decomposition.ranks_per_dim;
+            if (std::all_of(ranks.begin(), ranks.end(), [](const int r) { return r == 0; }))
+                partitioner = std::make_shared<Cajita::DimBlockPartitioner<NumSpaceDim>>();
+            else
+                partitioner = std::make_shared<Cajita::ManualBlockPartitioner<NumSpaceDim>>(ranks);
+            std::array<bool, NumSpaceDim> periodic;
+            periodic.fill(true);
+            auto global_grid = Cajita::createGlobalGrid(comm, global_mesh, periodic, *partitioner);
+
+            //create local stuff:
+            return Cajita::createLocalGrid(global_grid, halo_width);
+        });
+        layout = PlanCache::layout<NumSpaceDim>(local_grid, dofs);
+        arena = PlanCache::arena(local_grid);
+    }
+
+    //Add to the local node indices that node_parallel_for passes to get global ones (e.g. for positions)
+    std::array<int, NumSpaceDim> local_to_global() const {
+        const auto own_space = local_grid->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local());
+        std::array<int, NumSpaceDim> offset;
+        for (std::size_t d=0; d<NumSpaceDim; d++)
+            offset[d] = local_grid->globalGrid().globalOffset(d) - own_space.min(d);
+        return offset;
+    }
+
+    //lambda(i, j[, k]) over an index space of the grid's (local) nodes, on space, launched as set_kernel_tuning says
+    template<class ExecSpace, class FunctorType>
+    void index_parallel_for(const char* label, const ExecSpace& space, const Cajita::IndexSpace<NumSpaceDim>& index_space,
+        FunctorType lambda)
     {
-        std::array<double, NumSpaceDim> low_corner;
-        low_corner.fill(0.0);
-        std::array<double, NumSpaceDim> high_corner;
-        high_corner.fill(size);
-        std::array<int, NumSpaceDim> num_cell;
-        num_cell.fill(grid_points);
-        auto global_mesh = Cajita::createUniformGlobalMesh(
-            low_corner, high_corner, num_cell
-        );
-        Cajita::DimBlockPartitioner<NumSpaceDim> partitioner;
-        std::array<bool, NumSpaceDim> periodic;
-        periodic.fill(true);
-        auto global_grid = Cajita::createGlobalGrid(MPI_COMM_WORLD, global_mesh, periodic, partitioner);
-
-        //create local stuff:
-        local_grid = Cajita::createLocalGrid(global_grid, 0);
-        layout = createArrayLayout(local_grid, 2, Cajita::Node()); //2: real & imag
+        std::array<long, NumSpaceDim> min, max;
+        for (std::size_t d=0; d<NumSpaceDim; d++) {
+            min[d] = index_space.min(d);
+            max[d] = index_space.max(d);
+        }
+        tuned_parallel_for<Contiguous::last>(label, space, min, max, tuning, lambda);
     }
 
     template<class FunctorType>
-    void node_parallel_for(const std::string& label, FunctorType lambda) {
-        Cajita::grid_parallel_for(label, exec_space(), *local_grid, Cajita::Own(), Cajita::Node(), lambda);
+    void node_parallel_for(const char* label, FunctorType lambda) {
+        index_parallel_for(label, exec_space(), local_grid->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local()), lambda);
+    }
+
+    //lambda(i, j[, k]) over every point of a spectrum (or anything with its shape and layout, like the operators)
+    template<class View_t, class FunctorType>
+    void spectral_parallel_for(const char* label, const View_t& spectrum, FunctorType lambda) {
+        std::array<long, NumSpaceDim> min, max;
+        for (std::size_t d=0; d<NumSpaceDim; d++) {
+            min[d] = 0;
+            max[d] = spectrum.extent(d);
+        }
+        tuned_parallel_for<Contiguous::first>(label, exec_space(), min, max, tuning, lambda);
     }
 
     template<class FunctorType>
-    double node_parallel_reduce(const std::string& label, FunctorType lambda) {
+    double node_parallel_reduce(const char* label, FunctorType lambda) {
         double result = 0;
         Cajita::grid_parallel_reduce(label, exec_space(), *local_grid, Cajita::Own(), Cajita::Node(), lambda, result);
         return result;
     }
 
+    //Several sums in one pass: lambda(i, j, [k,] sum1, sum2, ...) adds to each, and the totals are put in results
+    template<class FunctorType, class... Results>
+    void node_parallel_reduce(const char* label, FunctorType lambda, Results&... results) {
+        const auto own_space = local_grid->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local());
+        Kokkos::parallel_reduce(label, Cajita::createExecutionPolicy(own_space, exec_space()), lambda, results...);
+    }
+
     void timestep(int count) {
-        if (!have_initialized) {
-            initialize();
-            have_initialized = true;
-        }
-        for(int i=0; i<count; i++) {
-            pre_step();
-            step();
-            post_step();
-            timesteps_done++;
-        }
-        if (timesteps_done==timesteps)
-            finalize();
+        run(*this, count);
+    }
+
+    /*In fused mode, each timestep is a single call to fused_step(), so a problem can combine its pointwise work
+    with the FFTs (see PFVariables::fft_forward_fused) rather than sweeping over the fields in each phase.*/
+    void set_fused(bool value) {
+        fused = value;
+        reset_graph();
+    }
+
+    /*Record a timestep's device work as a CUDA/HIP graph and replay it for the timesteps after, instead of launching
+    every kernel and FFT separately, which mostly pays off at small grids.  Only for problems whose timesteps are
+    capturable(), on a single rank (heFFTe's MPI can't be in a graph), while phase timing and Kokkos Tools are off;
+    diagnostic timesteps are taken normally.  If capturing fails (or there are no graphs, as on CPUs), timesteps are
+    taken normally and graphs_in_use() turns false.*/
+    void set_graph_capture(bool value) {
+        int size;
+        MPI_Comm_size(comm(), &size);
+        use_graphs = value && size == 1;
+        reset_graph();
+    }
+
+    bool graphs_in_use() const {
+        return use_graphs;
+    }
+
+    /*Tile sizes, or a TeamPolicy, for the pointwise kernels (see KernelTuning); worth trying per architecture, e.g.
+    teams with wide vectors on CPUs that don't vectorize the MDRange tiles well.  Results are the same either way.*/
+    void set_kernel_tuning(const KernelTuning<NumSpaceDim>& value) {
+        tuning = value;
+        reset_graph();
+    }
+
+    const KernelTuning<NumSpaceDim>& kernel_tuning() const {
+        return tuning;
+    }
+
+    //Scratch memory use so far, FFT buffers included, e.g. to see how large a grid fits
+    const ScratchUsage& scratch_usage() const {
+        return arena->usage();
+    }
+
+    //Give back the scratch memory that isn't in use (it is reallocated when next needed)
+    void trim_scratch() {
+        reset_graph();      //so the graph's scratch memory can go too
+        arena->trim();
+    }
+
+    //Per-phase timing of timestep(); off by default, since every phase boundary then fences
+    PhaseTimers& phase_timers() {
+        return timers;
+    }
+
+    /*Measure throughput every interval timesteps (fencing at each measurement), and report it to any loaded
+    Kokkos Tools as an event.  The latest values are available from steps_per_second() and points_per_second().*/
+    void set_counter_interval(int interval) {
+        counter_interval = interval;
+        Kokkos::fence();
+        counter_start = std::chrono::steady_clock::now();
+        counter_start_step = timesteps_done;
+    }
+
+    double timesteps_per_second() const {
+        return steps_per_second;
+    }
+
+    //grid points updated per second, over the whole (global) grid
+    double points_per_second() const {
+        return steps_per_second * std::pow(static_cast<double>(grid_points), NumSpaceDim);
+    }
+
+    //Call snapshot() every interval timesteps (0 to stop)
+    void set_output_interval(int interval) {
+        output_interval = interval;
+    }
+
+    //Call snapshot() at the first timestep reaching each of these simulation times (see simulation_time())
+    void set_output_times(std::vector<double> times) {
+        std::sort(times.begin(), times.end());
+        output_times = times;
+        next_output_time = std::lower_bound(output_times.begin(), output_times.end(), simulation_time()) - output_times.begin();
+    }
+
+    /*Have the problem compute its diagnostics (see Diagnostics) every interval timesteps (0 to stop), on the device and
+    as part of kernels it runs anyway where it can, with a single MPI_Allreduce.  With log, rank 0 prints each set.*/
+    void set_diagnostic_interval(int interval, bool log = true) {
+        diagnostic_interval = interval;
+        log_diagnostics = log;
+    }
+
+    /*Stop timestep() early, and call finalize(), once the criterion is met.  The tests use the diagnostics, so they
+    cost nothing extra beyond computing those (which is turned on at criterion.interval if it isn't already).*/
+    void set_convergence(const ConvergenceCriterion& criterion) {
+        convergence = criterion;
+        recent_energies.clear();
+        if (converged && !finished())   //a new criterion starts afresh, so a run stopped by an earlier one goes on
+            finalized = false;          //(and is finalized again when it stops)
+        converged = false;
+        if (diagnostic_interval == 0)
+            set_diagnostic_interval(criterion.interval, false);
+    }
+
+    //Whether the run stopped early because it met the convergence criterion
+    bool has_converged() const {
+        return converged;
+    }
+
+    //The most recently computed diagnostics
+    const Diagnostics& diagnostics() const {
+        return latest_diagnostics;
+    }
+
+    MPI_Comm comm() const {
+        return local_grid->globalGrid().comm();
     }
 
     //Generally, you inherit from this class and implement one or more of these:
@@ -75,7 +458,27 @@ public:
     virtual void pre_step() {}   //Called each timestep
     virtual void step() {}       //Called each timestep, after pre_step
     virtual void post_step() {}  //Called each timestep, after step
+    virtual void fused_step() { pre_step(); step(); post_step(); }  //Called each timestep instead, in fused mode
     virtual void finalize() {}   //Called once, when the requested number of timesteps have been done
+    virtual void snapshot() {}   //Called after a timestep when the output schedule says so
+    virtual double simulation_time() const { return timesteps_done; }   //in the problem's units, if it has them
+    virtual bool finished() const { return timesteps_done >= timesteps; }  //whether the run is over (e.g. reached its end time)
+    //whether every timestep not due for diagnostics does the same device work and nothing on the host (see set_graph_capture)
+    virtual bool capturable() const { return false; }
+};
+
+/*Binds the timestep loop to Problem at compile time: derive the (final) problem class from StaticTimestep<Problem, Base>
+instead of Base, and timestep() then calls its phases directly instead of through the vtable.  This matters at small
+grids, where each timestep is a handful of short kernels and host overhead adds up.*/
+template <class Problem, class Base>
+class StaticTimestep : public Base {
+public:
+    using Base::Base;
+
+    void timestep(int count) {
+        static_assert(std::is_final_v<Problem>, "the phases can only be bound at compile time for a final class");
+        this->run(static_cast<Problem&>(*this), count);
+    }
 };
 
 }
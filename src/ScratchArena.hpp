@@ -0,0 +1,213 @@
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <Kokkos_Core.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace CabanaPF {
+
+//Memory use of a ScratchArena, in bytes
+struct ScratchUsage {
+    std::size_t reserved = 0;       //allocated on the device, leased or not
+    std::size_t leased = 0;         //handed out right now
+    std::size_t peak_reserved = 0;
+    std::size_t peak_leased = 0;
+    long allocations = 0;           //how often a lease needed a new block rather than reusing one
+};
+
+/*A pool of device memory for temporaries: intermediate fields, FFT workspaces, and the like.  A lease takes the
+smallest free block that fits (allocating one if there isn't any), and gives it back when it goes out of scope, so
+the same memory serves whichever field or FFT needs it next, and steady timesteps allocate nothing.  Blocks are only
+freed by trim() or when the arena (and every lease) is gone.  Everything here runs on the default instance, so a
+block can be handed on as soon as it is returned, without a fence: the next user's kernels queue up behind the last
+ones.  A captured timestep (see StepGraph) is different, since its replays use the blocks it leased while being
+recorded without leasing them again; retain() keeps those from being leased or freed until the graph is gone.*/
+class ScratchArena {
+    using memory_space = Kokkos::DefaultExecutionSpace::memory_space;
+    static constexpr std::size_t alignment = 256;
+
+    struct Block {
+        void* data;
+        std::size_t bytes;
+        int holders;    //leases of it, 0 if free
+    };
+
+    struct Pool {
+        std::vector<Block> blocks;
+        ScratchUsage usage;
+        bool recording = false;     //inside retain()
+        std::vector<void*> recorded;    //the blocks leased there
+
+        ~Pool() {
+            for (const auto& block : blocks)
+                Kokkos::kokkos_free<memory_space>(block.data);
+        }
+
+        void give_back(void* data) {
+            for (auto& block : blocks) {
+                if (block.data == data) {
+                    if (--block.holders == 0)
+                        usage.leased -= block.bytes;
+                    return;
+                }
+            }
+        }
+    };
+
+    std::shared_ptr<Pool> pool;
+
+public:
+    //A block of scratch memory, given back to the arena when this is destroyed (or released)
+    class Lease {
+        std::shared_ptr<Pool> pool;     //keeps the memory around, even if the arena goes first
+        void* ptr = nullptr;
+        std::size_t size = 0;
+
+        friend class ScratchArena;
+        Lease(std::shared_ptr<Pool> pool, void* ptr, const std::size_t size) : pool{std::move(pool)}, ptr{ptr}, size{size} {}
+
+    public:
+        Lease() = default;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        Lease(Lease&& other) noexcept : pool{std::move(other.pool)}, ptr{other.ptr}, size{other.size} {
+            other.ptr = nullptr;
+            other.size = 0;
+        }
+
+        Lease& operator=(Lease&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool = std::move(other.pool);
+                ptr = other.ptr;
+                size = other.size;
+                other.ptr = nullptr;
+                other.size = 0;
+            }
+            return *this;
+        }
+
+        ~Lease() {
+            release();
+        }
+
+        void release() {
+            if (pool && ptr)
+                pool->give_back(ptr);
+            pool.reset();
+            ptr = nullptr;
+            size = 0;
+        }
+
+        void* data() const {
+            return ptr;
+        }
+
+        std::size_t bytes() const {
+            return size;
+        }
+    };
+
+    //A View over leased memory: the View is only valid while the lease is held
+    template <class View_t>
+    struct Scratch {
+        Lease lease;
+        View_t view;
+    };
+
+    ScratchArena() : pool{std::make_shared<Pool>()} {}
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    Lease lease(const std::size_t bytes) {
+        if (bytes == 0)
+            return Lease();
+        const std::size_t rounded = (bytes + alignment - 1) / alignment * alignment;
+        Block* best = nullptr;
+        for (auto& block : pool->blocks)
+            if (!block.holders && block.bytes >= rounded && (!best || block.bytes < best->bytes))
+                best = &block;
+        if (!best) {
+            void* data;
+            try {
+                data = Kokkos::kokkos_malloc<memory_space>("CabanaPF::ScratchArena", rounded);
+            } catch (std::exception&) {    //out of memory: free what isn't leased, and try once more
+                trim();
+                data = Kokkos::kokkos_malloc<memory_space>("CabanaPF::ScratchArena", rounded);
+            }
+            pool->blocks.push_back({data, rounded, 0});
+            best = &pool->blocks.back();
+            pool->usage.reserved += rounded;
+            pool->usage.peak_reserved = std::max(pool->usage.peak_reserved, pool->usage.reserved);
+            pool->usage.allocations++;
+        }
+        best->holders = 1;
+        pool->usage.leased += best->bytes;
+        pool->usage.peak_leased = std::max(pool->usage.peak_leased, pool->usage.leased);
+        if (pool->recording && std::find(pool->recorded.begin(), pool->recorded.end(), best->data) == pool->recorded.end())
+            pool->recorded.push_back(best->data);
+        return Lease(pool, best->data, best->bytes);
+    }
+
+    /*Run f, and return a lease of every block it leased, so they stay out of other leases and trim() even once f has
+    given them back.  For work that is recorded while f runs and replayed later (see StepGraph), which keeps using
+    the same blocks: hold the returned leases for as long as the recording is kept.*/
+    template <class Function>
+    std::vector<Lease> retain(Function&& f) {
+        pool->recording = true;
+        pool->recorded.clear();
+        try {
+            f();
+        } catch (...) {
+            pool->recording = false;
+            throw;
+        }
+        pool->recording = false;
+        std::vector<Lease> retained;
+        for (auto& block : pool->blocks) {
+            if (std::find(pool->recorded.begin(), pool->recorded.end(), block.data) == pool->recorded.end())
+                continue;
+            if (block.holders++ == 0) {
+                pool->usage.leased += block.bytes;
+                pool->usage.peak_leased = std::max(pool->usage.peak_leased, pool->usage.leased);
+            }
+            retained.push_back(Lease(pool, block.data, block.bytes));
+        }
+        pool->recorded.clear();
+        return retained;
+    }
+
+    //Lease enough for a View_t with the given extents, e.g. view<Kokkos::View<double**>>(nx, ny)
+    template <class View_t, class... Extents>
+    Scratch<View_t> view(const Extents... extents) {
+        auto memory = lease(View_t::required_allocation_size(extents...));
+        View_t scratch_view(static_cast<typename View_t::pointer_type>(memory.data()), extents...);
+        return {std::move(memory), scratch_view};
+    }
+
+    //Free the blocks that aren't leased (e.g. after setup, or before something else needs the device memory)
+    void trim() {
+        Kokkos::fence();    //a block's last user may still be running
+        auto& blocks = pool->blocks;
+        for (const auto& block : blocks) {
+            if (!block.holders) {
+                Kokkos::kokkos_free<memory_space>(block.data);
+                pool->usage.reserved -= block.bytes;
+            }
+        }
+        blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [](const Block& block) { return !block.holders; }), blocks.end());
+    }
+
+    const ScratchUsage& usage() const {
+        return pool->usage;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Cajita.hpp>
+#include <mpi.h>
+
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace CabanaPF {
+
+//Which global nodes a snapshot keeps: every stride-th node of the box [low, high)
+template <std::size_t NumSpaceDim>
+struct SnapshotRegion {
+    std::array<int, NumSpaceDim> low{};
+    std::array<int, NumSpaceDim> high{};    //0 means the end of the grid in that dimension
+    int stride = 1;
+};
+
+/*How snapshot values are stored.  Reduced precision and quantization are applied on the device, so they also cut
+the host transfer.  Quantized values are stored as 16-bit integers (32-bit if the range needs it) and decode as
+offset + scale*q, with offset and scale in the .bov header; each decoded value is within error_bound of the original.
+If the range needs more steps than a 32-bit integer holds, the values are stored as doubles instead.*/
+struct SnapshotFormat {
+    enum class Precision { Double, Float, Quantized };
+    Precision precision = Precision::Double;
+    bool first_component_only = false;  //e.g. only the real part of a complex field
+    double error_bound = 0;     //for Quantized: the maximum absolute error
+};
+
+/*Writes one field, reduced to a region of interest and/or downsampled, as a raw file plus a .bov header (for
+VisIt/ParaView).  The reduction happens on the device before anything is copied to the host, so only the kept
+values are transferred and written.  Every rank writes its part of the reduced grid with one collective MPI-IO call.*/
+template <std::size_t NumSpaceDim>
+class SnapshotWriter {
+    using execution_space = Kokkos::DefaultExecutionSpace;
+    using memory_space = typename execution_space::memory_space;
+    using Mesh = Cajita::UniformMesh<double, NumSpaceDim>;
+
+    MPI_Comm comm;
+    int dofs;       //components written per node
+    int stride;
+    SnapshotFormat format;
+    double cell_size;
+    std::array<int, NumSpaceDim> region_low;
+    std::array<int, NumSpaceDim> out_size;      //reduced global grid
+    std::array<int, NumSpaceDim> out_start;     //this rank's part of it
+    std::array<int, NumSpaceDim> out_count;
+    std::array<int, NumSpaceDim> local_first;   //local index of this rank's first kept node
+    long local_points;
+
+public:
+    SnapshotWriter(const Cajita::ArrayLayout<Cajita::Node, Mesh>& layout, const SnapshotRegion<NumSpaceDim>& region,
+        const SnapshotFormat& format = SnapshotFormat())
+        : dofs{format.first_component_only ? 1 : layout.dofsPerEntity()}, stride{region.stride}, format{format}, local_points{1}
+    {
+        if (stride < 1)
+            throw std::invalid_argument("Snapshot stride must be at least 1");
+        if (format.precision == SnapshotFormat::Precision::Quantized && !(format.error_bound > 0))
+            throw std::invalid_argument("Quantized snapshots need a positive error bound");
+        const auto local_grid = layout.localGrid();
+        const auto& global_grid = local_grid->globalGrid();
+        comm = global_grid.comm();
+        cell_size = global_grid.globalMesh().cellSize(0);
+        const auto own_space = local_grid->indexSpace(Cajita::Own(), Cajita::Node(), Cajita::Local());
+        for (std::size_t d=0; d<NumSpaceDim; d++) {
+            const int points = global_grid.globalNumEntity(Cajita::Node(), d);
+            const int low = region.low[d];
+            const int high = region.high[d] == 0 ? points : region.high[d];
+            if (low < 0 || high > points || low >= high)
+                throw std::invalid_argument("Snapshot region is outside the grid");
+            region_low[d] = low;
+            out_size[d] = (high - low + stride - 1) / stride;
+            //the kept nodes that fall in this rank's owned block:
+            const int own_low = global_grid.globalOffset(d);
+            const int own_high = own_low + own_space.extent(d);
+            const int start = std::max(low, own_low);
+            const int first = low + (start - low + stride - 1) / stride * stride;
+            const int last = std::min(high, own_high);
+            out_count[d] = first < last ? (last - first + stride - 1) / stride : 0;
+            out_start[d] = (first - low) / stride;
+            local_first[d] = own_space.min(d) + first - own_low;
+            local_points *= out_count[d];
+        }
+    }
+
+private:
+    static void check(const int error, const std::string& what, const std::string& file_name) {
+        if (error != MPI_SUCCESS) {
+            char message[MPI_MAX_ERROR_STRING];
+            int length;
+            MPI_Error_string(error, message, &length);
+            throw std::runtime_error("Snapshot " + file_name + ": " + what + " failed: " + std::string(message, length));
+        }
+    }
+
+    //Collective: write this rank's part of the reduced grid, already packed on the host
+    template <class Host_t>
+    void write_data(const std::string& data_name, const Host_t& host, MPI_Datatype value_type) {
+        MPI_File file;
+        check(MPI_File_open(comm, data_name.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file), "open", data_name);
+        int error = MPI_File_set_size(file, 0);
+        std::string what = "truncate";
+        MPI_Datatype block_type = value_type;
+        if (local_points > 0) {
+            //MPI's Fortran order makes the first index (the dof) fastest
+            int sizes[NumSpaceDim+1], subsizes[NumSpaceDim+1], starts[NumSpaceDim+1];
+            sizes[0] = subsizes[0] = dofs;
+            starts[0] = 0;
+            for (std::size_t d=0; d<NumSpaceDim; d++) {
+                sizes[d+1] = out_size[d];
+                subsizes[d+1] = out_count[d];
+                starts[d+1] = out_start[d];
+            }
+            MPI_Type_create_subarray(NumSpaceDim+1, sizes, subsizes, starts, MPI_ORDER_FORTRAN, value_type, &block_type);
+            MPI_Type_commit(&block_type);
+        }
+        //every rank goes through each collective call, and the file and type are freed, before any error is thrown
+        const int view_error = MPI_File_set_view(file, 0, value_type, block_type, "native", MPI_INFO_NULL);
+        if (error == MPI_SUCCESS) {
+            error = view_error;
+            what = "set view";
+        }
+        const int write_error = MPI_File_write_all(file, host.data(), host.size(), value_type, MPI_STATUS_IGNORE);
+        if (error == MPI_SUCCESS) {
+            error = write_error;
+            what = "write";
+        }
+        const int close_error = MPI_File_close(&file);
+        if (error == MPI_SUCCESS) {
+            error = close_error;
+            what = "close";
+        }
+        if (local_points > 0)
+            MPI_Type_free(&block_type);
+        check(error, what, data_name);
+    }
+
+    //Convert the packed values on the device, then copy them over and write them
+    template <class T, class Packed_t, class Convert>
+    void write_as(const std::string& data_name, const Packed_t& packed, MPI_Datatype value_type, const Convert& convert) {
+        Kokkos::View<T*, memory_space> converted(Kokkos::ViewAllocateWithoutInitializing("snapshot converted"), packed.size());
+        Kokkos::parallel_for("snapshot convert", Kokkos::RangePolicy<execution_space>(0, packed.size()), KOKKOS_LAMBDA(const long w) {
+            converted(w) = convert(packed(w));
+        });
+        write_data(data_name, Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), converted), value_type);
+    }
+
+public:
+    //Collective: write the region of the given array to file_name.dat and file_name.bov
+    template <class Array_t>
+    void write(const std::string& file_name, const Array_t& array, const double time) {
+        Kokkos::View<double*, memory_space> packed(Kokkos::ViewAllocateWithoutInitializing("snapshot buffer"), dofs*local_points);
+        const auto view = array.view();
+        const int n = dofs, s = stride;
+        const int cx = out_count[0], cy = out_count[1];
+        const int x0 = local_first[0], y0 = local_first[1];
+        if (local_points > 0) {
+            if constexpr (NumSpaceDim == 3) {
+                const int z0 = local_first[2];
+                Kokkos::parallel_for("snapshot pack", Kokkos::MDRangePolicy<execution_space, Kokkos::Rank<3>>({0, 0, 0},
+                        {out_count[0], out_count[1], out_count[2]}), KOKKOS_LAMBDA(const int a, const int b, const int c) {
+                    const long w = a + cx*(b + static_cast<long>(cy)*c);
+                    for (int d=0; d<n; d++)
+                        packed(n*w+d) = view(x0 + s*a, y0 + s*b, z0 + s*c, d);
+                });
+            } else {
+                Kokkos::parallel_for("snapshot pack", Kokkos::MDRangePolicy<execution_space, Kokkos::Rank<2>>({0, 0},
+                        {out_count[0], out_count[1]}), KOKKOS_LAMBDA(const int a, const int b) {
+                    const long w = a + static_cast<long>(cx)*b;
+                    for (int d=0; d<n; d++)
+                        packed(n*w+d) = view(x0 + s*a, y0 + s*b, d);
+                });
+            }
+        }
+
+        const std::string data_name = file_name + ".dat";
+        std::string data_format = "DOUBLE";
+        double offset = 0, scale = 1;
+        bool quantized = format.precision == SnapshotFormat::Precision::Quantized;
+        if (format.precision == SnapshotFormat::Precision::Double) {
+            write_data(data_name, Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), packed), MPI_DOUBLE);
+        } else if (format.precision == SnapshotFormat::Precision::Float) {
+            data_format = "FLOAT";
+            write_as<float>(data_name, packed, MPI_FLOAT, KOKKOS_LAMBDA(const double value) { return static_cast<float>(value); });
+        } else {
+            //quantize around the middle of the global range, with steps of twice the error bound
+            double low = std::numeric_limits<double>::max(), high = std::numeric_limits<double>::lowest();
+            Kokkos::parallel_reduce("snapshot range", Kokkos::RangePolicy<execution_space>(0, packed.size()),
+                KOKKOS_LAMBDA(const long w, double& min, double& max) {
+                    min = Kokkos::fmin(min, packed(w));
+                    max = Kokkos::fmax(max, packed(w));
+                }, Kokkos::Min<double>(low), Kokkos::Max<double>(high));
+            MPI_Allreduce(MPI_IN_PLACE, &low, 1, MPI_DOUBLE, MPI_MIN, comm);
+            MPI_Allreduce(MPI_IN_PLACE, &high, 1, MPI_DOUBLE, MPI_MAX, comm);
+            offset = low <= high ? (low + high) / 2 : 0;
+            scale = 2*format.error_bound;
+            const double center = offset, inverse_scale = 1/scale;
+            const double steps = (high - low) / 2 * inverse_scale;     //the largest |q|, before rounding
+            if (steps < std::numeric_limits<short>::max()) {
+                data_format = "SHORT";
+                write_as<short>(data_name, packed, MPI_SHORT, KOKKOS_LAMBDA(const double value) {
+                    return static_cast<short>(Kokkos::round((value - center) * inverse_scale));
+                });
+            } else if (steps < std::numeric_limits<int>::max()) {
+                data_format = "INT";
+                write_as<int>(data_name, packed, MPI_INT, KOKKOS_LAMBDA(const double value) {
+                    return static_cast<int>(Kokkos::round((value - center) * inverse_scale));
+                });
+            } else {
+                /*too many steps for an int (a tiny error bound, or an outlier), so store the values as they are: floats
+                might not meet the error bound either, so doubles, which the header then says instead*/
+                offset = 0;
+                scale = 1;
+                quantized = false;
+                write_data(data_name, Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), packed), MPI_DOUBLE);
+            }
+        }
+
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        if (0 == rank) {
+            std::ofstream bov(file_name + ".bov");
+            const auto slash = data_name.find_last_of('/');
+            bov << "TIME: " << time << "\n";
+            bov << "DATA_FILE: " << (slash == std::string::npos ? data_name : data_name.substr(slash+1)) << "\n";
+            bov << "DATA_SIZE:";
+            for (std::size_t d=0; d<3; d++)
+                bov << " " << (d < NumSpaceDim ? out_size[d] : 1);
+            bov << "\nDATA_FORMAT: " << data_format << "\nVARIABLE: " << array.label() << "\nDATA_ENDIAN: LITTLE\nCENTERING: nodal\n";
+            bov << "BRICK_ORIGIN:";
+            for (std::size_t d=0; d<3; d++)
+                bov << " " << (d < NumSpaceDim ? region_low[d]*cell_size : 0);
+            bov << "\nBRICK_SIZE:";
+            for (std::size_t d=0; d<3; d++)
+                bov << " " << (d < NumSpaceDim ? out_size[d]*stride*cell_size : 1);
+            bov << "\nDATA_COMPONENTS: " << dofs << "\n";
+            if (quantized)
+                bov << std::setprecision(17) << "# value = QUANTIZATION_OFFSET + QUANTIZATION_SCALE*stored\n"
+                    << "# QUANTIZATION_OFFSET: " << offset << "\n# QUANTIZATION_SCALE: " << scale << "\n";
+            if (!bov.flush())
+                throw std::runtime_error("Snapshot " + file_name + ".bov: write failed");
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SPECTRALOPERATORS_H
+#define SPECTRALOPERATORS_H
+
+#include <Cajita.hpp>
+
+namespace CabanaPF {
+
+/*Wavenumber-based operators for this rank's block of Fourier space, in the same (x fastest) layout as the
+spectra in PFVariables.  Only the owned block is stored, and it is indexed by global k, so each rank holds
+about N^d/P values no matter how many ranks there are.*/
+template <std::size_t NumSpaceDim>
+class SpectralOperators {
+    using execution_space = Kokkos::DefaultExecutionSpace;
+    using memory_space = typename execution_space::memory_space;
+public:
+    using Operator_type = std::conditional_t<3 == NumSpaceDim, Kokkos::View<double***, Kokkos::LayoutLeft, memory_space>,
+        Kokkos::View<double**, Kokkos::LayoutLeft, memory_space>>;
+
+    Operator_type k2;   //|k|^2 (the laplacian is -k2)
+    Operator_type k4;   //|k|^4 (the biharmonic)
+
+    //Wavenumber of global index i along a dimension with the given number of points.  The Nyquist mode is zeroed.
+    static KOKKOS_INLINE_FUNCTION double wavenumber(const int i, const int points, const double size) {
+        const int mode = i > points/2 ? i - points : 2*i == points ? 0 : i;
+        return 2*M_PI*mode/size;
+    }
+
+    //offset and extent describe this rank's block of the spectrum (see PFVariables::spectrum_offset)
+    SpectralOperators(const std::array<int, NumSpaceDim>& offset, const std::array<int, NumSpaceDim>& extent,
+        const int points, const double size)
+    {
+        k2 = create("k^2", extent);
+        k4 = create("k^4", extent);
+        const auto k2_view = k2;
+        const auto k4_view = k4;
+        const int x0 = offset[0], y0 = offset[1];
+        if constexpr (NumSpaceDim == 3) {
+            const int z0 = offset[2];
+            Kokkos::parallel_for("spectral operators", Kokkos::MDRangePolicy<execution_space, Kokkos::Rank<3>>({0, 0, 0},
+                    {extent[0], extent[1], extent[2]}), KOKKOS_LAMBDA(const int i, const int j, const int k) {
+                const double kx = wavenumber(i + x0, points, size);
+                const double ky = wavenumber(j + y0, points, size);
+                const double kz = wavenumber(k + z0, points, size);
+                k2_view(i, j, k) = kx*kx + ky*ky + kz*kz;
+                k4_view(i, j, k) = k2_view(i, j, k) * k2_view(i, j, k);
+            });
+        } else {
+            Kokkos::parallel_for("spectral operators", Kokkos::MDRangePolicy<execution_space, Kokkos::Rank<2>>({0, 0},
+                    {extent[0], extent[1]}), KOKKOS_LAMBDA(const int i, const int j) {
+                const double kx = wavenumber(i + x0, points, size);
+                const double ky = wavenumber(j + y0, points, size);
+                k2_view(i, j) = kx*kx + ky*ky;
+                k4_view(i, j) = k2_view(i, j) * k2_view(i, j);
+            });
+        }
+    }
+
+    static Operator_type create(const std::string& label, const std::array<int, NumSpaceDim>& extent) {
+        if constexpr (NumSpaceDim == 3)
+            return Operator_type(label, extent[0], extent[1], extent[2]);
+        else
+            return Operator_type(label, extent[0], extent[1]);
+    }
+};
+
+}
+
+#endif
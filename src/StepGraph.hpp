@@ -0,0 +1,134 @@
+#ifndef STEPGRAPH_H
+#define STEPGRAPH_H
+
+#include <Kokkos_Core.hpp>
+
+#if defined(KOKKOS_ENABLE_CUDA)
+#include <cuda_runtime.h>
+#elif defined(KOKKOS_ENABLE_HIP)
+#include <hip/hip_runtime.h>
+#endif
+
+#include <exception>
+
+namespace CabanaPF {
+
+#if defined(KOKKOS_ENABLE_CUDA)
+using DeviceStream = cudaStream_t;
+//The stream of Kokkos's default instance, which every kernel here (and heFFTe, see FFT) is launched on
+inline DeviceStream device_stream() {
+    return Kokkos::DefaultExecutionSpace().cuda_stream();
+}
+#elif defined(KOKKOS_ENABLE_HIP)
+using DeviceStream = hipStream_t;
+inline DeviceStream device_stream() {
+    return Kokkos::DefaultExecutionSpace().hip_stream();
+}
+#endif
+
+/*One timestep's device work (kernels, FFTs, copies), recorded as a CUDA/HIP graph by stream capture and then
+replayed with a single launch, which saves most of the per-kernel launch overhead when the grid is small.  Capture
+fails if the work does anything that can't be recorded, such as a fence, a host copy, or MPI, or if Kokkos's
+default instance is on the legacy default stream; capture() then returns false and nothing is kept.  Note that
+capturing only records the work: it does not run it.  Other backends have no graphs, so capture() always fails.*/
+class StepGraph {
+#if defined(KOKKOS_ENABLE_CUDA)
+    cudaGraphExec_t graph = nullptr;
+#elif defined(KOKKOS_ENABLE_HIP)
+    hipGraphExec_t graph = nullptr;
+#endif
+    bool is_captured = false;
+
+public:
+    StepGraph() = default;
+    StepGraph(const StepGraph&) = delete;
+    StepGraph& operator=(const StepGraph&) = delete;
+
+    ~StepGraph() {
+        reset();
+    }
+
+    bool captured() const {
+        return is_captured;
+    }
+
+    //Record what f launches on the default instance; returns whether that worked
+    template <class Function>
+    bool capture(Function&& f) {
+        reset();
+#if defined(KOKKOS_ENABLE_CUDA)
+        const auto stream = device_stream();
+        if (cudaStreamBeginCapture(stream, cudaStreamCaptureModeRelaxed) != cudaSuccess) {
+            cudaGetLastError();
+            return false;
+        }
+        bool recorded = true;
+        try {
+            f();
+        } catch (std::exception&) {     //e.g. Kokkos reporting that a fence isn't allowed while capturing
+            recorded = false;
+        }
+        cudaGraph_t recording = nullptr;
+        recorded = cudaStreamEndCapture(stream, &recording) == cudaSuccess && recorded;
+        if (recorded)
+            recorded = cudaGraphInstantiateWithFlags(&graph, recording, 0) == cudaSuccess;
+        if (recording)
+            cudaGraphDestroy(recording);
+        cudaGetLastError();     //a failed capture leaves an error behind
+        is_captured = recorded;
+#elif defined(KOKKOS_ENABLE_HIP)
+        const auto stream = device_stream();
+        if (hipStreamBeginCapture(stream, hipStreamCaptureModeRelaxed) != hipSuccess) {
+            (void) hipGetLastError();
+            return false;
+        }
+        bool recorded = true;
+        try {
+            f();
+        } catch (std::exception&) {
+            recorded = false;
+        }
+        hipGraph_t recording = nullptr;
+        recorded = hipStreamEndCapture(stream, &recording) == hipSuccess && recorded;
+        if (recorded)
+            recorded = hipGraphInstantiate(&graph, recording, nullptr, nullptr, 0) == hipSuccess;
+        if (recording)
+            (void) hipGraphDestroy(recording);
+        (void) hipGetLastError();
+        is_captured = recorded;
+#else
+        (void) f;
+#endif
+        if (!is_captured)
+            reset();
+        return is_captured;
+    }
+
+    //Run the recorded work again (asynchronously, on the default instance)
+    void launch() {
+#if defined(KOKKOS_ENABLE_CUDA)
+        KOKKOS_IMPL_CUDA_SAFE_CALL(cudaGraphLaunch(graph, device_stream()));
+#elif defined(KOKKOS_ENABLE_HIP)
+        KOKKOS_IMPL_HIP_SAFE_CALL(hipGraphLaunch(graph, device_stream()));
+#endif
+    }
+
+    //Forget the recording, e.g. because the timestep's work has changed
+    void reset() {
+#if defined(KOKKOS_ENABLE_CUDA)
+        if (graph)
+            cudaGraphExecDestroy(graph);
+#elif defined(KOKKOS_ENABLE_HIP)
+        if (graph)
+            (void) hipGraphExecDestroy(graph);
+#endif
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP)
+        graph = nullptr;
+#endif
+        is_captured = false;
+    }
+};
+
+}
+
+#endif
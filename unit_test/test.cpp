@@ -1,9 +1,25 @@
 #include <gtest/gtest.h>
 #include <Cabana_Core.hpp>
 #include <Cajita.hpp>
+#include <cmath>
+#include <cstdio>
+#include <complex>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <vector>
 
+#include <CahnHilliard.hpp>
+#include <DeviceBinding.hpp>
+#include <Ensemble.hpp>
+#include <FiniteDifference.hpp>
+#include <KernelTuning.hpp>
 #include <PFHub.hpp>
+#include <PFHub2.hpp>
 #include <PFVariables.hpp>
+#include <PlanCache.hpp>
+#include <ScratchArena.hpp>
+#include <SpectralOperators.hpp>
 
 using namespace CabanaPF;
 
@@ -75,6 +91,760 @@ TEST(PFHub1a, AllTimestep) {
     EXPECT_NEAR(0.6482746495041702, results(67, 7, 0), 1e-9);
 }
 
+//Fused mode evaluates df_dc while packing for the FFT, which should give the same answer
+TEST(PFHub1a, Fused) {
+    PFHub1aBenchmark simulation(96, 500);
+    PFHub1aBenchmark fused(96, 500);
+    fused.set_fused(true);
+    simulation.timestep(10);
+    fused.timestep(10);
+    auto results = simulation.get_cpu_view();
+    auto fused_results = fused.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), fused_results(i, j, 0), 1e-12);
+        }
+    }
+}
+
+//Stepping through a CabanaPFRunner reference uses the virtual phases instead of the static ones, which should not matter
+TEST(PFHub1a, VirtualDispatch) {
+    PFHub1aBenchmark simulation(96, 500);
+    PFHub1aBenchmark through_base(96, 500);
+    simulation.timestep(10);
+    CabanaPFRunner<2>& runner = through_base;
+    runner.timestep(10);
+    auto results = simulation.get_cpu_view();
+    auto base_results = through_base.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_EQ(results(i, j, 0), base_results(i, j, 0));
+        }
+    }
+}
+
+//Replaying captured timesteps (where the backend has graphs) should give the same answer, diagnostic timesteps included
+TEST(PFHub1a, GraphCapture) {
+    PFHub1aBenchmark simulation(96, 500);
+    PFHub1aBenchmark replayed(96, 500);
+    simulation.set_diagnostic_interval(7, false);
+    replayed.set_diagnostic_interval(7, false);
+    replayed.set_graph_capture(true);
+    simulation.timestep(20);
+    replayed.timestep(20);
+    EXPECT_EQ(14, replayed.diagnostics().timestep);
+    EXPECT_DOUBLE_EQ(simulation.diagnostics().free_energy, replayed.diagnostics().free_energy);
+    auto results = simulation.get_cpu_view();
+    auto replayed_results = replayed.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), replayed_results(i, j, 0), 1e-12);
+        }
+    }
+}
+
+//Float storage and FFTs should stay close to the double run, with diagnostics still summed in double
+TEST(PFHub1a, SinglePrecision) {
+    PFHub1aBenchmark simulation(96, 500);
+    BasicPFHub1aBenchmark<float> single(96, 500);
+    simulation.set_diagnostic_interval(10, false);
+    single.set_diagnostic_interval(10, false);
+    simulation.timestep(10);
+    single.timestep(10);
+    auto results = simulation.get_cpu_view();
+    auto single_results = single.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), single_results(i, j, 0), 1e-5);
+        }
+    }
+    EXPECT_NEAR(simulation.diagnostics().mass, single.diagnostics().mass, 1e-6*simulation.diagnostics().mass);
+    EXPECT_NEAR(simulation.diagnostics().free_energy, single.diagnostics().free_energy, 1e-4*std::abs(simulation.diagnostics().free_energy));
+}
+
+//Each member of an ensemble should end up where its own run would, including ones that stop early
+TEST(PFHub1a, Ensemble) {
+    PFHub1aEnsemble<PFHub1aBenchmark> ensemble(96, {40, 20, 0});
+    EXPECT_EQ(40, ensemble.timesteps);
+    ensemble.timestep(40);
+    EXPECT_TRUE(ensemble.finished());
+    for (const int member : {0, 1}) {
+        PFHub1aBenchmark single(96, ensemble.timesteps_of(member));
+        single.timestep(ensemble.timesteps_of(member));
+        auto results = single.get_cpu_view();
+        auto member_results = ensemble.get_cpu_view(member);
+        for (int i=0; i<96; i++) {
+            for (int j=0; j<96; j++) {
+                EXPECT_NEAR(results(i, j, 0), member_results(i, j, 0), 1e-10);   //batched and single FFTs may round differently
+            }
+        }
+    }
+    //a member with no timesteps keeps its initial conditions
+    EXPECT_DOUBLE_EQ(0.53, ensemble.get_cpu_view(2)(0, 0, 0));
+}
+
+//Every sweep point goes to a group, and they come back in the order given: with a single group, all of them
+TEST(Ensemble, Assignment) {
+    EnsembleGroups groups(MPI_COMM_WORLD, 1);
+    const std::vector<int> everything{0, 1, 2, 3};
+    EXPECT_EQ(everything, groups.assigned({1, 8, 2, 4}));
+}
+
+//In 2D, the memory-lean model should take the same timesteps as PFHub1a itself
+TEST(CahnHilliard, MatchesPFHub1a) {
+    PFHub1aPeriodic reference(96, 500);
+    PeriodicCahnHilliard<2> simulation(96, 500);
+    reference.timestep(10);
+    simulation.timestep(10);
+    auto results = reference.get_cpu_view();
+    auto lean_results = simulation.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), lean_results(i, j, 0), 1e-12);
+        }
+    }
+}
+
+//A 3D run that starts out the same along z should stay that way, with every plane matching the 2D run
+TEST(CahnHilliard, Extruded3D) {
+    PeriodicCahnHilliard<2> flat(32, 500);
+    PeriodicCahnHilliard<3> simulation(32, 500);
+    simulation.timestep(0);     //initialize, then replace c with the 2D initial conditions
+    auto start = simulation.get_cpu_view();
+    const double delta = 200./32;
+    for (int i=0; i<32; i++)
+        for (int j=0; j<32; j++)
+            for (int k=0; k<32; k++)
+                start(i, j, k, 0) = PFHub1aPeriodic::initial_c(delta*i, delta*j);
+    Kokkos::deep_copy(simulation.vars[0], start);
+    flat.timestep(10);
+    simulation.timestep(10);
+    auto results = flat.get_cpu_view();
+    auto results_3d = simulation.get_cpu_view();
+    for (int i=0; i<32; i++) {
+        for (int j=0; j<32; j++) {
+            for (int k=0; k<32; k++) {
+                EXPECT_NEAR(results(i, j, 0), results_3d(i, j, k, 0), 1e-12);
+            }
+        }
+    }
+}
+
+//Over a short run, where the grid resolves the initial conditions well, the stencil backend should follow the spectral one
+TEST(FiniteDifference, MatchesSpectral) {
+    CahnHilliardParameters parameters;
+    parameters.end_time = 20;
+    PeriodicCahnHilliard<2> spectral(96, 1000, parameters);
+    PeriodicCahnHilliard<2, double, FiniteDifferenceCahnHilliard> stencil(96, 1000, parameters);
+    spectral.timestep(1000);
+    stencil.timestep(1000);
+    auto results = spectral.get_cpu_view();
+    auto stencil_results = stencil.get_cpu_view();
+    double start_mass = 0, end_mass = 0;
+    const double delta = 200./96;
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), stencil_results(i, j, 0), 1e-3);
+            start_mass += PFHub1aPeriodic::initial_c(delta*i, delta*j);
+            end_mass += stencil_results(i, j, 0);
+        }
+    }
+    EXPECT_NEAR(start_mass, end_mass, 1e-9*start_mass);     //the differences conserve c exactly, up to rounding
+}
+
+//Updating the interior during the halo exchange only changes the order of the kernels, not any results
+TEST(FiniteDifference, Overlap) {
+    CahnHilliardParameters parameters;
+    parameters.end_time = 2;
+    PeriodicCahnHilliard<3, double, FiniteDifferenceCahnHilliard> overlapped(24, 100, parameters);
+    PeriodicCahnHilliard<3, double, FiniteDifferenceCahnHilliard> sequential(24, 100, parameters);
+    sequential.set_overlap(false);
+    overlapped.timestep(100);
+    sequential.timestep(100);
+    auto results = overlapped.get_cpu_view();
+    auto sequential_results = sequential.get_cpu_view();
+    for (int i=0; i<24; i++)
+        for (int j=0; j<24; j++)
+            for (int k=0; k<24; k++)
+                EXPECT_EQ(results(i, j, k, 0), sequential_results(i, j, k, 0));
+}
+
+//Each rank should get a place on its node, and a GPU of its own share if there are any
+TEST(DeviceBinding, Detect) {
+    const auto binding = detect_device_binding();
+    EXPECT_GE(binding.local_rank, 0);
+    EXPECT_GE(binding.local_size, 1);
+    if (binding.devices > 0) {
+        EXPECT_EQ(binding.local_rank % binding.devices, binding.device);
+    } else {
+        EXPECT_EQ(-1, binding.device);
+    }
+#if !defined(KOKKOS_ENABLE_CUDA) && !defined(KOKKOS_ENABLE_HIP)
+    EXPECT_FALSE(binding.gpu_aware_mpi);    //GPU builds assume it when MPI can't say, even without visible GPUs
+#endif
+    //on a sub-communicator, the rank and size both count that communicator's ranks
+    const auto self = detect_device_binding(MPI_COMM_SELF);
+    EXPECT_EQ(0, self.local_rank);
+    EXPECT_EQ(1, self.local_size);
+}
+
+//c should be conserved, and two order parameters that start out the same should stay the same
+TEST(PFHub2, ConservationAndSymmetry) {
+    PFHub2Parameters parameters;
+    parameters.end_time = 10;
+    PFHub2Benchmark<3> simulation(64, 100, parameters);
+    simulation.timestep(0);     //initialize, then make eta3 a copy of eta2
+    Kokkos::deep_copy(simulation.vars[3], simulation.vars[2]);
+    const auto current = simulation.get_cpu_view(0);
+    auto start = Kokkos::create_mirror(current);    //a copy, since on host builds get_cpu_view may be the live field
+    Kokkos::deep_copy(start, current);
+    simulation.timestep(100);
+    const auto c = simulation.get_cpu_view(0);
+    const auto eta1 = simulation.get_cpu_view(1);
+    const auto eta2 = simulation.get_cpu_view(2);
+    const auto eta3 = simulation.get_cpu_view(3);
+    double start_mass = 0, end_mass = 0, change = 0, c_change = 0;
+    for (int i=0; i<64; i++) {
+        for (int j=0; j<64; j++) {
+            start_mass += start(i, j, 0);
+            end_mass += c(i, j, 0);
+            c_change += std::abs(c(i, j, 0) - start(i, j, 0));
+            change += std::abs(eta1(i, j, 0) - PFHub2Benchmark<3>::initial_eta(1, 200./64*i, 200./64*j));
+            EXPECT_NEAR(eta2(i, j, 0), eta3(i, j, 0), 1e-12);
+        }
+    }
+    EXPECT_NEAR(start_mass, end_mass, 1e-10*start_mass);
+    EXPECT_GT(c_change, 0);     //so conservation isn't trivial
+    EXPECT_GT(change, 0);   //the order parameters do evolve
+}
+
+//The chemical potentials should match finite differences of the free energy density
+TEST(PFHub2, ChemicalPotentials) {
+    constexpr std::size_t N = PFHub2Base<2>::NumFields;
+    const PFHub2Parameters p;
+    const auto f = [&](const Kokkos::Array<double, 2*N>& u) {
+        const double c = u[0];
+        double h = 0, g = 0;
+        for (std::size_t q=1; q<N; q++) {
+            h += u[q]*u[q]*u[q]*(6*u[q]*u[q] - 15*u[q] + 10);
+            g += u[q]*u[q]*(1-u[q])*(1-u[q]);
+            for (std::size_t r=1; r<N; r++)
+                if (r != q)
+                    g += p.alpha*u[q]*u[q]*u[r]*u[r];
+        }
+        return p.rho2*(c-p.c_alpha)*(c-p.c_alpha)*(1-h) + p.rho2*(p.c_beta-c)*(p.c_beta-c)*h + p.w*g;
+    };
+    Kokkos::Array<double, 2*N> values;
+    values[0] = .45;
+    values[1] = .3;
+    values[2] = .8;
+    PFHub2Base<2>::chemical_potentials(values, p);
+    const double step = 1e-6;
+    for (std::size_t v=0; v<N; v++) {
+        auto plus = values, minus = values;
+        plus[v] += step;
+        minus[v] -= step;
+        EXPECT_NEAR((f(plus) - f(minus)) / (2*step), values[N + v], 1e-6);
+    }
+}
+
+//Returned blocks should be reused by later leases that fit, and only trim() should free them
+TEST(ScratchArena, Reuse) {
+    ScratchArena arena;
+    void* first;
+    {
+        auto lease = arena.lease(1000);
+        first = lease.data();
+        EXPECT_GE(lease.bytes(), 1000u);
+    }
+    EXPECT_EQ(0u, arena.usage().leased);
+    auto smaller = arena.lease(500);
+    EXPECT_EQ(first, smaller.data());
+    auto other = arena.view<Kokkos::View<double**>>(10, 20);
+    EXPECT_NE(first, other.lease.data());
+    EXPECT_EQ(2, arena.usage().allocations);
+    EXPECT_EQ(arena.usage().reserved, arena.usage().peak_leased);
+    smaller.release();
+    arena.trim();
+    EXPECT_EQ(other.lease.bytes(), arena.usage().reserved);
+}
+
+//Blocks leased inside retain() should stay out of later leases and trim() until the retained leases are released
+TEST(ScratchArena, Retain) {
+    ScratchArena arena;
+    void* recorded = nullptr;
+    auto retained = arena.retain([&]() {
+        auto first = arena.lease(1000);
+        recorded = first.data();
+        first.release();
+        auto second = arena.lease(800);     //reuses the same block within the recording
+        EXPECT_EQ(recorded, second.data());
+    });
+    ASSERT_EQ(1u, retained.size());
+    EXPECT_EQ(recorded, retained[0].data());
+    auto later = arena.lease(500);
+    EXPECT_NE(recorded, later.data());
+    later.release();
+    arena.trim();
+    EXPECT_EQ(retained[0].bytes(), arena.usage().reserved);
+    retained.clear();
+    arena.trim();
+    EXPECT_EQ(0u, arena.usage().reserved);
+}
+
+//Steady timesteps should lease the same memory every time, rather than allocating
+TEST(PFHub1a, ScratchReuse) {
+    PFHub1aBenchmark simulation(96, 500);
+    simulation.timestep(2);
+    const auto usage = simulation.scratch_usage();
+    EXPECT_GT(usage.peak_reserved, 0u);
+    simulation.timestep(5);
+    EXPECT_EQ(usage.allocations, simulation.scratch_usage().allocations);
+    EXPECT_EQ(usage.peak_reserved, simulation.scratch_usage().peak_reserved);
+}
+
+//Simulations sharing cached grids and plans, even side by side, should get the same answers as ones that don't
+TEST(PFHub1a, PlanCache) {
+    PFHub1aBenchmark uncached(96, 500);
+    PlanCache::enable(true);
+    const long misses = PlanCache::misses();
+    PFHub1aBenchmark first(96, 500);
+    const long hits = PlanCache::hits();
+    PFHub1aBenchmark second(96, 500);
+    EXPECT_GT(PlanCache::hits(), hits);
+    EXPECT_EQ(PlanCache::misses() - misses, PlanCache::hits() - hits);  //the second one found everything the first built
+    PlanCache::enable(false);
+    PlanCache::clear();
+    for (int step=0; step<10; step++) {
+        first.timestep(1);
+        second.timestep(1);
+    }
+    uncached.timestep(10);
+    auto results = uncached.get_cpu_view();
+    auto first_results = first.get_cpu_view();
+    auto second_results = second.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_EQ(results(i, j, 0), first_results(i, j, 0));
+            EXPECT_EQ(results(i, j, 0), second_results(i, j, 0));
+        }
+    }
+}
+
+//Transforming c and df_dc one after the other, df_dc computed on the side, should give the batched timesteps
+TEST(PFHub1a, Pipelined) {
+    PFHub1aBenchmark batched(96, 500);
+    PFHub1aBenchmark pipelined(96, 500);
+    PFHub1aBenchmark pipelined_fused(96, 500);
+    pipelined.set_pipelined(true);
+    pipelined_fused.set_pipelined(true);
+    pipelined_fused.set_fused(true);
+    batched.timestep(10);
+    pipelined.timestep(10);
+    pipelined_fused.timestep(10);
+    auto results = batched.get_cpu_view();
+    auto pipelined_results = pipelined.get_cpu_view();
+    auto fused_results = pipelined_fused.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            //two single transforms against one batched one, which may round differently
+            EXPECT_NEAR(results(i, j, 0), pipelined_results(i, j, 0), 1e-10);
+            EXPECT_NEAR(results(i, j, 0), fused_results(i, j, 0), 1e-10);
+        }
+    }
+}
+
+//Tiles and teams only change the order points are visited in, so the results should be exactly the same
+TEST(PFHub1a, KernelTuning) {
+    PFHub1aBenchmark reference(96, 500);
+    PFHub1aBenchmark tiled(96, 500);
+    PFHub1aBenchmark teams(96, 500);
+    KernelTuning<2> tiles;
+    tiles.tile = {4, 16};
+    tiled.set_kernel_tuning(tiles);
+    KernelTuning<2> team;
+    team.team = true;
+    teams.set_kernel_tuning(team);
+    reference.timestep(10);
+    tiled.timestep(10);
+    teams.timestep(10);
+    auto results = reference.get_cpu_view();
+    auto tiled_results = tiled.get_cpu_view();
+    auto team_results = teams.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_EQ(results(i, j, 0), tiled_results(i, j, 0));
+            EXPECT_EQ(results(i, j, 0), team_results(i, j, 0));
+        }
+    }
+}
+
+//The on-device diagnostics should match sums over the host copy, conserve mass, and lower the free energy
+TEST(PFHub1a, Diagnostics) {
+    PFHub1aBenchmark simulation(96, 500);
+    simulation.set_diagnostic_interval(1, false);
+    simulation.timestep(1);
+    const Diagnostics first = simulation.diagnostics();
+    EXPECT_EQ(1, first.timestep);
+
+    auto results = simulation.get_cpu_view();
+    const double area = (200./96)*(200./96);
+    double mass = 0, norm = 0;
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            mass += area*results(i, j, 0);
+            norm += area*results(i, j, 0)*results(i, j, 0);
+        }
+    }
+    EXPECT_NEAR(mass, first.mass, 1e-9*mass);
+    EXPECT_NEAR(std::sqrt(norm), first.l2_norm, 1e-9*std::sqrt(norm));
+    EXPECT_GT(first.l2_change, 0);
+
+    //the free energy should be of the same (updated) c: bulk by direct sum, gradient by a host DFT
+    const int n = 96;
+    const double wavenumber = 2*M_PI/200.;
+    std::vector<std::complex<double>> rows(n*n), spectrum(n*n);
+    for (int i=0; i<n; i++)
+        for (int m=0; m<n; m++)
+            for (int j=0; j<n; j++)
+                rows[i*n+m] += results(i, j, 0)*std::polar(1.0, -2*M_PI*m*j/n);
+    for (int l=0; l<n; l++)
+        for (int m=0; m<n; m++)
+            for (int i=0; i<n; i++)
+                spectrum[l*n+m] += rows[i*n+m]*std::polar(1.0, -2*M_PI*l*i/n);
+    double bulk = 0, gradient = 0;
+    for (int i=0; i<n; i++)
+        for (int j=0; j<n; j++)
+            bulk += area*PFHub1aBase::f_bulk(results(i, j, 0));
+    for (int l=0; l<n; l++) {
+        for (int m=0; m<n; m++) {
+            //the Nyquist modes have no wavenumber, as in SpectralOperators
+            const double kx = 2*l == n ? 0 : wavenumber*(l < n/2 ? l : l-n);
+            const double ky = 2*m == n ? 0 : wavenumber*(m < n/2 ? m : m-n);
+            gradient += (kx*kx + ky*ky)*std::norm(spectrum[l*n+m]);
+        }
+    }
+    const double energy = bulk + PFHub1aBase::_KAPPA/2 * area*gradient/(n*n);
+    EXPECT_NEAR(energy, first.free_energy, 1e-9*energy);
+
+    simulation.set_fused(true);
+    simulation.timestep(9);
+    const Diagnostics later = simulation.diagnostics();
+    EXPECT_EQ(10, later.timestep);
+    EXPECT_NEAR(first.mass, later.mass, 1e-9*first.mass);
+    EXPECT_LT(later.free_energy, first.free_energy);
+}
+
+//finalize() should be called once, when the run finishes, however many more timesteps are asked for
+TEST(Runner, FinalizeOnce) {
+    struct Counting : public CabanaPFRunner<2> {
+        int finalize_calls = 0;
+        Counting() : CabanaPFRunner<2>(8, 3, 1.0) {}
+        void finalize() override {
+            finalize_calls++;
+        }
+    } runner;
+    runner.timestep(2);
+    EXPECT_EQ(0, runner.finalize_calls);
+    runner.timestep(1);
+    EXPECT_EQ(1, runner.finalize_calls);
+    runner.timestep(2);
+    EXPECT_EQ(1, runner.finalize_calls);
+    EXPECT_EQ(3, runner.simulation_time());
+}
+
+//A run that meets its convergence criterion should stop at that diagnostic timestep
+TEST(PFHub1a, EarlyTermination) {
+    PFHub1aBenchmark simulation(96, 500);
+    ConvergenceCriterion criterion;
+    criterion.relative_change = 1;  //always met, since c barely changes in one timestep
+    criterion.interval = 5;
+    simulation.set_convergence(criterion);
+    simulation.timestep(500);
+    EXPECT_TRUE(simulation.has_converged());
+    EXPECT_EQ(5, simulation.diagnostics().timestep);
+    simulation.timestep(10);
+    EXPECT_EQ(5, simulation.diagnostics().timestep);
+    //a new criterion, never met, lets the run go on
+    ConvergenceCriterion never;
+    simulation.set_convergence(never);
+    EXPECT_FALSE(simulation.has_converged());
+    simulation.timestep(10);
+    EXPECT_EQ(15, simulation.diagnostics().timestep);
+
+    PFHub1aBenchmark unconverged(96, 500);
+    criterion.relative_change = 0;  //both tests off
+    criterion.energy_change = 0;
+    unconverged.set_convergence(criterion);
+    unconverged.timestep(20);
+    EXPECT_FALSE(unconverged.has_converged());
+    EXPECT_EQ(20, unconverged.diagnostics().timestep);
+}
+
+//Adaptive timestepping should reach the end time in fewer timesteps than the fixed run, close to its answer
+TEST(PFHub1a, Adaptive) {
+    PFHub1aBenchmark fixed(96, 500);
+    fixed.timestep(500);
+    PFHub1aBenchmark adaptive(96, 500);
+    AdaptiveTimestepping options;
+    options.tolerance = 1e-6;
+    adaptive.set_adaptive(options);
+    adaptive.set_diagnostic_interval(1, false);
+    adaptive.timestep(1000000);     //stops at END_TIME
+    EXPECT_NEAR(PFHub1aBase::END_TIME, adaptive.simulation_time(), 1e-9);
+    EXPECT_TRUE(adaptive.finished());
+    EXPECT_LT(adaptive.diagnostics().timestep, 500);
+
+    auto results = fixed.get_cpu_view();
+    auto adaptive_results = adaptive.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), adaptive_results(i, j, 0), 1e-2);
+        }
+    }
+}
+
+//Switching to adaptive timestepping part way through a run should carry on from the time already reached
+TEST(PFHub1a, AdaptiveMidRun) {
+    PFHub1aBenchmark fixed(96, 500);
+    fixed.timestep(500);
+    PFHub1aBenchmark switched(96, 500);
+    switched.timestep(100);
+    AdaptiveTimestepping options;
+    options.tolerance = 1e-6;
+    switched.set_adaptive(options);
+    EXPECT_NEAR(100 * (PFHub1aBase::END_TIME/500), switched.simulation_time(), 1e-9);
+    switched.set_diagnostic_interval(1, false);
+    switched.timestep(1);
+    EXPECT_EQ(101, switched.diagnostics().timestep);
+    EXPECT_GT(switched.diagnostics().time, 100 * (PFHub1aBase::END_TIME/500));
+    switched.timestep(1000000);     //stops at END_TIME, not a further END_TIME on
+    EXPECT_NEAR(PFHub1aBase::END_TIME, switched.simulation_time(), 1e-9);
+    EXPECT_TRUE(switched.finished());
+
+    auto results = fixed.get_cpu_view();
+    auto switched_results = switched.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), switched_results(i, j, 0), 1e-2);
+        }
+    }
+}
+
+//ETDRK4 should change much less than semi-implicit Euler when the timestep is refined, being higher order
+TEST(PFHub1a, ETDRK4) {
+    const auto max_difference = [](PFHub1aBenchmark& a, PFHub1aBenchmark& b) {
+        auto a_results = a.get_cpu_view();
+        auto b_results = b.get_cpu_view();
+        double difference = 0;
+        for (int i=0; i<96; i++)
+            for (int j=0; j<96; j++)
+                difference = std::max(difference, std::abs(a_results(i, j, 0) - b_results(i, j, 0)));
+        return difference;
+    };
+    PFHub1aBenchmark euler_coarse(96, 125), euler_fine(96, 500);
+    PFHub1aBenchmark etd_coarse(96, 125), etd_fine(96, 500);
+    etd_coarse.set_integrator(std::make_shared<ETDRK4<2>>());
+    etd_fine.set_integrator(std::make_shared<ETDRK4<2>>());
+    euler_coarse.timestep(125);
+    euler_fine.timestep(500);
+    etd_coarse.timestep(125);
+    etd_fine.timestep(500);
+    EXPECT_LT(max_difference(etd_coarse, etd_fine), max_difference(euler_coarse, euler_fine));
+}
+
+//An integrator shared by problems on different grids should give each the same answer as an integrator of its own
+TEST(PFHub1a, SharedIntegrator) {
+    const auto shared = std::make_shared<ETDRK2<2>>();
+    PFHub1aBenchmark large(96, 500), small(64, 500);
+    large.set_integrator(shared);
+    small.set_integrator(shared);
+    for (int i=0; i<5; i++) {   //alternating, so the coefficients and stage spectra are switched every step
+        large.timestep(1);
+        small.timestep(1);
+    }
+    PFHub1aBenchmark large_alone(96, 500), small_alone(64, 500);
+    large_alone.set_integrator(std::make_shared<ETDRK2<2>>());
+    small_alone.set_integrator(std::make_shared<ETDRK2<2>>());
+    large_alone.timestep(5);
+    small_alone.timestep(5);
+    for (auto [simulation, alone, points] : {std::make_tuple(&large, &large_alone, 96), std::make_tuple(&small, &small_alone, 64)}) {
+        auto results = simulation->get_cpu_view();
+        auto alone_results = alone->get_cpu_view();
+        for (int i=0; i<points; i++) {
+            for (int j=0; j<points; j++) {
+                EXPECT_EQ(alone_results(i, j, 0), results(i, j, 0));
+            }
+        }
+    }
+}
+
+//Delete a checkpoint a test wrote, once every rank is done with it
+void remove_checkpoint(PFHub1aBenchmark& simulation, const std::string& run_name, const int timesteps_done) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (0 == rank)
+        std::remove(simulation.vars.checkpoint_name(run_name, timesteps_done).c_str());
+}
+
+//Restarting from a checkpoint should continue exactly where the original run was
+TEST(PFHub1a, CheckpointRestart) {
+    PFHub1aBenchmark simulation(96, 500);
+    simulation.timestep(5);
+    simulation.checkpoint("TestCheckpoint");
+    simulation.timestep(5);
+
+    PFHub1aBenchmark restarted(96, 500);
+    restarted.restart("TestCheckpoint", 5);
+    restarted.timestep(5);
+    auto results = simulation.get_cpu_view();
+    auto restarted_results = restarted.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_EQ(results(i, j, 0), restarted_results(i, j, 0));
+        }
+    }
+    remove_checkpoint(simulation, "TestCheckpoint", 5);
+}
+
+//An asynchronous checkpoint is a snapshot from when it was requested, even though the run kept going
+TEST(PFHub1a, AsyncCheckpoint) {
+    PFHub1aBenchmark simulation(96, 500);
+    simulation.timestep(5);
+    const auto current = simulation.get_cpu_view();
+    auto snapshot = Kokkos::create_mirror(current);     //a copy, since on host builds get_cpu_view is the live field
+    Kokkos::deep_copy(snapshot, current);
+    simulation.checkpoint("TestAsyncCheckpoint", true);
+    simulation.timestep(5);
+    simulation.wait_for_output();
+
+    PFHub1aBenchmark restarted(96, 500);
+    restarted.restart("TestAsyncCheckpoint", 5);
+    auto restarted_results = restarted.get_cpu_view();
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_EQ(snapshot(i, j, 0), restarted_results(i, j, 0));
+        }
+    }
+    remove_checkpoint(simulation, "TestAsyncCheckpoint", 5);
+}
+
+//Delete the .dat and .bov files of a snapshot a test wrote, once every rank is done with them
+void remove_snapshot(PFHub1aBenchmark& simulation, const int timesteps_done) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (0 == rank) {
+        const std::string name = simulation.vars.base_name(simulation.run_name(), 0, timesteps_done);
+        std::remove((name + ".dat").c_str());
+        std::remove((name + ".bov").c_str());
+    }
+}
+
+//Scheduled snapshots should be written at the right timesteps, downsampled as requested
+TEST(PFHub1a, Snapshot) {
+    PFHub1aBenchmark simulation(96, 500);
+    simulation.set_output_interval(2);
+    SnapshotRegion<2> region;
+    region.stride = 2;
+    simulation.set_snapshot_region(region);
+    simulation.timestep(4);
+    auto results = simulation.get_cpu_view();
+
+    std::ifstream infile(simulation.vars.save_name(simulation.run_name(), 0, 4), std::ifstream::binary);
+    std::vector<double> snapshot(48*48);
+    infile.read((char*)snapshot.data(), snapshot.size()*sizeof(double));
+    ASSERT_TRUE(infile.good());
+    for (int i=0; i<48; i++) {
+        for (int j=0; j<48; j++) {
+            EXPECT_EQ(results(2*i, 2*j, 0), snapshot[i + 48*j]);
+        }
+    }
+    infile.close();
+    remove_snapshot(simulation, 2);
+    remove_snapshot(simulation, 4);
+}
+
+//Quantized snapshots should decode to within the error bound
+TEST(PFHub1a, QuantizedSnapshot) {
+    PFHub1aBenchmark simulation(96, 500);
+    simulation.set_output_interval(1);
+    SnapshotFormat format;
+    format.precision = SnapshotFormat::Precision::Quantized;
+    format.error_bound = 1e-4;
+    simulation.set_snapshot_format(format);
+    simulation.timestep(1);
+    auto results = simulation.get_cpu_view();
+
+    const std::string name = simulation.vars.base_name(simulation.run_name(), 0, 1);
+    std::ifstream header(name + ".bov");
+    double offset = 0, scale = 0;
+    std::string line;
+    while (std::getline(header, line)) {
+        std::stringstream fields(line);
+        std::string hash, key;
+        fields >> hash >> key;
+        if (key == "QUANTIZATION_OFFSET:")
+            fields >> offset;
+        else if (key == "QUANTIZATION_SCALE:")
+            fields >> scale;
+    }
+    EXPECT_DOUBLE_EQ(2e-4, scale);
+
+    std::ifstream infile(name + ".dat", std::ifstream::binary);
+    std::vector<short> snapshot(96*96);
+    infile.read((char*)snapshot.data(), snapshot.size()*sizeof(short));
+    ASSERT_TRUE(infile.good());
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_NEAR(results(i, j, 0), offset + scale*snapshot[i + 96*j], 1e-4*(1 + 1e-9));
+        }
+    }
+    infile.close();
+    remove_snapshot(simulation, 1);
+}
+
+//An error bound too small for 32-bit steps over the range should store doubles instead, rather than overflow
+TEST(PFHub1a, QuantizedSnapshotFallback) {
+    PFHub1aBenchmark simulation(96, 500);
+    simulation.set_output_interval(1);
+    SnapshotFormat format;
+    format.precision = SnapshotFormat::Precision::Quantized;
+    format.error_bound = 1e-15;
+    simulation.set_snapshot_format(format);
+    simulation.timestep(1);
+    auto results = simulation.get_cpu_view();
+
+    const std::string name = simulation.vars.base_name(simulation.run_name(), 0, 1);
+    std::ifstream header(name + ".bov");
+    std::string line, data_format;
+    bool quantized = false;
+    while (std::getline(header, line)) {
+        std::stringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "DATA_FORMAT:")
+            fields >> data_format;
+        else if (line.find("QUANTIZATION") != std::string::npos)
+            quantized = true;
+    }
+    EXPECT_EQ("DOUBLE", data_format);
+    EXPECT_FALSE(quantized);
+
+    std::ifstream infile(name + ".dat", std::ifstream::binary);
+    std::vector<double> snapshot(96*96);
+    infile.read((char*)snapshot.data(), snapshot.size()*sizeof(double));
+    ASSERT_TRUE(infile.good());
+    for (int i=0; i<96; i++) {
+        for (int j=0; j<96; j++) {
+            EXPECT_EQ(results(i, j, 0), snapshot[i + 96*j]);
+        }
+    }
+    infile.close();
+    remove_snapshot(simulation, 1);
+}
+
 #ifdef RESULTS_PATH
 TEST(PFVariables, saveload) {
     auto global_mesh = Cajita::createUniformGlobalMesh(
@@ -104,8 +874,123 @@ TEST(PFVariables, saveload) {
         }
     }
 }
+
+TEST(PFVariables, saveload3D) {
+    auto global_mesh = Cajita::createUniformGlobalMesh(
+        std::array<double, 3> {0, 0, 0},
+        std::array<double, 3> {6, 8, 10},
+        std::array<int, 3> {3, 4, 5}
+    );
+    Cajita::DimBlockPartitioner<3> partitioner;
+    auto global_grid = Cajita::createGlobalGrid(MPI_COMM_WORLD, global_mesh, std::array<bool, 3>{true, true, true}, partitioner);
+    auto local_grid = Cajita::createLocalGrid( global_grid, 0 );
+    auto layout = createArrayLayout(local_grid, 1, Cajita::Node());
+    PFVariables vars(layout, std::array<std::string, 1> {"b"});
+    for(int i=0; i<3; i++)
+        for(int j=0; j<4; j++)
+            for(int k=0; k<5; k++)
+                vars[0](i, j, k, 0) = 100*i+10*j+k;
+    vars.save(0, "Test3D", 0);
+
+    PFVariables from_file(layout, std::array<std::string, 1> {"b"});
+    from_file.load("Test3D", 0);
+    for (int i=0; i<3; i++)
+        for (int j=0; j<4; j++)
+            for (int k=0; k<5; k++)
+                EXPECT_EQ(vars[0](i, j, k, 0), from_file[0](i, j, k, 0));
+}
 #endif
 
+//The half spectrum from the real-to-complex FFT should match the complex-to-complex one
+TEST(PFVariables, RealToComplex) {
+    auto global_mesh = Cajita::createUniformGlobalMesh(
+        std::array<double, 2> {0, 0},
+        std::array<double, 2> {8, 8},
+        std::array<int, 2> {8, 8}
+    );
+    Cajita::DimBlockPartitioner<2> partitioner;
+    auto global_grid = Cajita::createGlobalGrid(MPI_COMM_WORLD, global_mesh, std::array<bool, 2>{true, true}, partitioner);
+    auto local_grid = Cajita::createLocalGrid( global_grid, 0 );
+    PFVariables real(createArrayLayout(local_grid, 1, Cajita::Node()), std::array<std::string, 1> {"real"});
+    PFVariables complex(createArrayLayout(local_grid, 2, Cajita::Node()), std::array<std::string, 1> {"complex"});
+    ASSERT_EQ(5, real.spectrum_extent()[0]);
+    ASSERT_EQ(8, complex.spectrum_extent()[0]);
+    for(int i=0; i<8; i++) {
+        for(int j=0; j<8; j++) {
+            real[0](i, j, 0) = std::sin(.1*i*i + j) + .5;
+            complex[0](i, j, 0) = std::sin(.1*i*i + j) + .5;
+            complex[0](i, j, 1) = 0;
+        }
+    }
+    real.fft_forward(0);
+    complex.fft_forward(0);
+    for (int i=0; i<5; i++) {
+        for (int j=0; j<8; j++) {
+            EXPECT_NEAR(complex.spectrum(0)(i, j).real(), real.spectrum(0)(i, j).real(), 1e-12);
+            EXPECT_NEAR(complex.spectrum(0)(i, j).imag(), real.spectrum(0)(i, j).imag(), 1e-12);
+        }
+    }
+    //and going back should recover the field:
+    real.fft_inverse(0);
+    for(int i=0; i<8; i++) {
+        for(int j=0; j<8; j++) {
+            EXPECT_NEAR(std::sin(.1*i*i + j) + .5, real[0](i, j, 0), 1e-12);
+        }
+    }
+}
+
+//Transforming both variables in one batch should give the same spectra as one at a time
+TEST(PFVariables, BatchedForward) {
+    auto global_mesh = Cajita::createUniformGlobalMesh(
+        std::array<double, 2> {0, 0},
+        std::array<double, 2> {8, 8},
+        std::array<int, 2> {8, 8}
+    );
+    Cajita::DimBlockPartitioner<2> partitioner;
+    auto global_grid = Cajita::createGlobalGrid(MPI_COMM_WORLD, global_mesh, std::array<bool, 2>{true, true}, partitioner);
+    auto local_grid = Cajita::createLocalGrid( global_grid, 0 );
+    auto layout = createArrayLayout(local_grid, 1, Cajita::Node());
+    PFVariables batched(layout, std::array<std::string, 2> {"a", "b"});
+    PFVariables single(layout, std::array<std::string, 2> {"a", "b"});
+    for(int i=0; i<8; i++) {
+        for(int j=0; j<8; j++) {
+            batched[0](i, j, 0) = single[0](i, j, 0) = std::cos(.3*i + .2*j*j);
+            batched[1](i, j, 0) = single[1](i, j, 0) = i - j*.5;
+        }
+    }
+    batched.fft_forward({0, 1});
+    single.fft_forward(0);
+    single.fft_forward(1);
+    for (int v=0; v<2; v++) {
+        for (int i=0; i<5; i++) {
+            for (int j=0; j<8; j++) {
+                EXPECT_NEAR(single.spectrum(v)(i, j).real(), batched.spectrum(v)(i, j).real(), 1e-12);
+                EXPECT_NEAR(single.spectrum(v)(i, j).imag(), batched.spectrum(v)(i, j).imag(), 1e-12);
+            }
+        }
+    }
+}
+
+//Operators use global wavenumbers, with the Nyquist mode zeroed
+TEST(SpectralOperators, wavenumbers) {
+    SpectralOperators<2> operators({0, 0}, {5, 8}, 8, 4*M_PI);
+    auto k2 = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), operators.k2);
+    auto k4 = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), operators.k4);
+    EXPECT_DOUBLE_EQ(0, k2(0, 0));
+    EXPECT_DOUBLE_EQ(.25, k2(1, 0));
+    EXPECT_DOUBLE_EQ(1.25, k2(1, 2));
+    EXPECT_DOUBLE_EQ(1, k2(0, 6));  //j=6 is the -2 mode
+    EXPECT_DOUBLE_EQ(.25, k2(1, 4));  //j=4 is Nyquist
+    EXPECT_DOUBLE_EQ(0, k2(4, 0));
+    EXPECT_DOUBLE_EQ(1.5625, k4(1, 2));
+
+    //a block in the middle of the spectrum (as on another rank) should use the same global wavenumbers:
+    SpectralOperators<2> block({1, 2}, {2, 2}, 8, 4*M_PI);
+    auto block_k2 = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), block.k2);
+    EXPECT_DOUBLE_EQ(k2(1, 2), block_k2(0, 0));
+    EXPECT_DOUBLE_EQ(k2(2, 3), block_k2(1, 1));
+}
+
 //Similar to above, the python implmentation was modified to use the periodic initial conditions
 TEST(PFHub1aPeriodic, periodic) {
     PFHub1aPeriodic simulation(96, 500);
@@ -136,6 +1021,7 @@ TEST(PFHub1aPeriodic, periodic) {
 
 int main(int argc, char** argv) {
     MPI_Init( &argc, &argv );
+    bind_device();
     Kokkos::initialize( argc, argv );
     ::testing::InitGoogleTest( &argc, argv );
     int return_val = RUN_ALL_TESTS();